@@ -1,11 +1,27 @@
 #pragma once
 
 #include "fib/attribute.h"
+#include "fib/cancel.h"
+#include "fib/channel.h"
 #include "fib/chrono.h"
+#include "fib/coro.h"
+#include "fib/cpu.h"
+#include "fib/fiber.h"
+#include "fib/future.h"
+#include "fib/graph.h"
+#include "fib/mapped.h"
 #include "fib/memory.h"
+#include "fib/random.h"
+#include "fib/reducer.h"
+#include "fib/task.h"
+#include "fib/timer.h"
+#include "fib/topology.h"
+#include "fib/trace.h"
 #include "fib/worker.h"
 #include "fib/wsdeque.h"
 #include "fib/rtm.h"
+#include "fib/sync.h"
+#include "fib/elided_mutex.h"
 
 /// @file fib.h
 /// @brief @ref fib
@@ -167,6 +167,16 @@
 #define FIB_ATTRIBUTE_ALWAYS_INLINE
 #endif
 
+/// @def FIB_ATTRIBUTE_NOINLINE
+/// @brief portable version of gcc's @p \__attribute__((noinline))
+///
+/// Used to force a fresh lookup of thread locals that a fiber may have migrated away from.
+#if FIB_HAS_GCC_ATTRIBUTE(noinline)
+#define FIB_ATTRIBUTE_NOINLINE __attribute__((noinline))
+#else
+#define FIB_ATTRIBUTE_NOINLINE
+#endif
+
 
 /// @def FIB_ATTRIBUTE_UNUSED
 /// @brief portable version of gcc's @p \__attribute__((unused))
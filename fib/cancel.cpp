@@ -0,0 +1,94 @@
+#include <mutex>
+
+#include "cancel.h"
+#include "worker.h"
+
+/// @file cancel.cpp
+/// @brief the token tree behind @ref fib::cancellation
+
+namespace fib {
+  namespace detail {
+    cancel_state::cancel_state() noexcept : parent(nullptr), children(nullptr), prev_sibling(nullptr), next_sibling(nullptr), callbacks(nullptr) {
+      cancelled.store(false, std::memory_order_relaxed);
+      refs.store(1, std::memory_order_relaxed);
+    }
+
+    cancel_state * cancel_state::make(cancel_state * parent) {
+      cancel_state * s = new cancel_state;
+      if (parent == nullptr) return s;
+      s->parent = share(parent);
+      std::lock_guard<spinlock> guard(parent->lock);
+      s->next_sibling = parent->children;
+      if (parent->children) parent->children->prev_sibling = s;
+      parent->children = s;
+      // checked under the lock, so we either see the cancellation here or the canceller sees us in its list
+      if (parent->cancelled.load(std::memory_order_relaxed)) s->cancelled.store(true, std::memory_order_release);
+      return s;
+    }
+
+    void release(cancel_state * s) noexcept {
+      while (s != nullptr && s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        cancel_state * parent = s->parent;
+        if (parent) {
+          std::lock_guard<spinlock> guard(parent->lock);
+          if (s->prev_sibling) s->prev_sibling->next_sibling = s->next_sibling;
+          else parent->children = s->next_sibling;
+          if (s->next_sibling) s->next_sibling->prev_sibling = s->prev_sibling;
+        }
+        delete s;
+        s = parent; // and drop the reference we held on it, without recursing
+      }
+    }
+
+    void cancel_state::cancel() noexcept {
+      if (cancelled.exchange(true, std::memory_order_acq_rel)) return;
+      std::lock_guard<spinlock> guard(lock);
+      for (cancel_callback * c = callbacks; c != nullptr;) {
+        cancel_callback * next = c->next;
+        c->linked = false;
+        c->fire(c);
+        c = next;
+      }
+      callbacks = nullptr;
+      // children can't go away while we hold the lock, as they have to take it to unlink themselves
+      for (cancel_state * c = children; c != nullptr; c = c->next_sibling)
+        c->cancel();
+    }
+
+    void cancel_state::attach(cancel_callback * c) noexcept {
+      lock.lock();
+      if (cancelled.load(std::memory_order_relaxed)) {
+        lock.unlock();
+        c->fire(c);
+        return;
+      }
+      c->prev = nullptr;
+      c->next = callbacks;
+      if (callbacks) callbacks->prev = c;
+      callbacks = c;
+      c->linked = true;
+      lock.unlock();
+    }
+
+    void cancel_state::detach(cancel_callback * c) noexcept {
+      std::lock_guard<spinlock> guard(lock);
+      if (!c->linked) return; // fired, or firing and we've now waited for it to finish
+      if (c->prev) c->prev->next = c->next;
+      else callbacks = c->next;
+      if (c->next) c->next->prev = c->prev;
+      c->linked = false;
+    }
+  }
+
+  cancellation cancellation::current() noexcept {
+    worker * w = worker::current();
+    return cancellation(w ? detail::share(w->token) : nullptr);
+  }
+
+  namespace this_fiber {
+    bool cancelled() noexcept {
+      worker * w = worker::current();
+      return w != nullptr && detail::dead(w->token);
+    }
+  }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <utility>
+
+#include "sync.h"
+#include "task.h"
+
+/// @file cancel.h
+/// @brief @ref fib::cancellation, cooperative cancellation of whole trees of tasks
+
+namespace fib {
+
+  namespace detail {
+    /// an intrusive registration on a @ref cancel_state. lives wherever the registrant puts it
+    struct cancel_callback {
+      void (*fire)(cancel_callback *) = nullptr;
+      void * data = nullptr;      ///< for @ref fire
+      cancel_callback * prev = nullptr;
+      cancel_callback * next = nullptr;
+      bool linked = false;
+    };
+
+    /// @brief the shared state behind a @ref cancellation
+    ///
+    /// Reference counted. Each child holds a reference to its parent, while parents only link to their children,
+    /// which unlink themselves as they go.
+    struct cancel_state {
+      std::atomic<bool> cancelled;
+      std::atomic<int> refs;
+      cancel_state * parent;
+      spinlock lock;               ///< guards the links below
+      cancel_state * children;
+      cancel_state * prev_sibling;
+      cancel_state * next_sibling;
+      cancel_callback * callbacks;
+
+      /// a new token with one reference, cancelled along with @p parent if that isn't null
+      static cancel_state * make(cancel_state * parent);
+
+      void retain() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+
+      /// cancel us, run our callbacks, and then do the same for each of our children
+      void cancel() noexcept;
+
+      /// @brief Call @p c when we are cancelled, or right away if we already have been.
+      ///
+      /// Publishing @p c is the last thing this does, so the registrant may be woken by it before it returns.
+      void attach(cancel_callback * c) noexcept;
+
+      /// unregister @p c, waiting for it to finish if it is running
+      void detach(cancel_callback * c) noexcept;
+
+    private:
+      cancel_state() noexcept;
+    };
+
+    /// take another reference to @p s, if there is one
+    inline cancel_state * share(cancel_state * s) noexcept {
+      if (s) s->retain();
+      return s;
+    }
+
+    /// has @p s, if there is one, been cancelled?
+    inline bool dead(const cancel_state * s) noexcept {
+      return s != nullptr && s->cancelled.load(std::memory_order_relaxed);
+    }
+
+    /// Is @p n waiting on a token that has been cancelled? Such tasks are dropped rather than run.
+    inline bool dead(const task_node * n) noexcept {
+      return dead(n->token);
+    }
+  }
+
+  /// @brief A cancellation token.
+  ///
+  /// Tokens form a tree: cancelling one cancels every token made from it by @ref child. Tasks spawned by a worker
+  /// inherit the token of the task that spawned them, so cancelling a token stops a whole subtree of work. Queued tasks
+  /// on a cancelled token are dropped when they would have been run or dealt, and running ones can poll
+  /// @ref cancelled, or register a @ref cancellation_callback to be told. Fibers sleeping in @ref this_fiber::sleep_until
+  /// under a cancelled token wake early.
+  ///
+  /// Suspended fibers and coroutines are never dropped, as their stacks or frames have to be unwound: they run on, and should check.
+  ///
+  /// A default constructed token is never cancelled. Copies share state. Safe to use from any thread.
+  struct cancellation {
+    cancellation() noexcept : state(nullptr) {}
+    cancellation(const cancellation & that) noexcept : state(detail::share(that.state)) {}
+    cancellation(cancellation && that) noexcept : state(that.state) { that.state = nullptr; }
+    cancellation & operator = (cancellation that) noexcept {
+      std::swap(state, that.state);
+      return *this;
+    }
+    ~cancellation() { if (state) detail::release(state); }
+
+    /// a fresh token, cancelled only through itself
+    static cancellation make() { return cancellation(detail::cancel_state::make(nullptr)); }
+
+    /// the token of the task running on this thread, which may be empty
+    static cancellation current() noexcept;
+
+    /// a fresh token, cancelled through itself or along with this one
+    cancellation child() const { return cancellation(detail::cancel_state::make(state)); }
+
+    /// cancel this token and all of its descendants. Only the first call does anything
+    void cancel() noexcept { if (state) state->cancel(); }
+
+    /// has this token, or one of its ancestors, been cancelled?
+    bool cancelled() const noexcept { return state != nullptr && state->cancelled.load(std::memory_order_acquire); }
+
+    /// can this token ever be cancelled?
+    explicit operator bool () const noexcept { return state != nullptr; }
+
+    /// @cond PRIVATE
+    explicit cancellation(detail::cancel_state * state) noexcept : state(state) {}
+    detail::cancel_state * get() const noexcept { return state; }
+    /// @endcond
+
+  private:
+    detail::cancel_state * state;
+  };
+
+  /// @brief Calls a function when a token is cancelled, for as long as this lives.
+  ///
+  /// The function runs on whichever thread cancels the token, or in the constructor if that has already happened.
+  /// It runs under a lock on the token, so it should be brief, e.g. waking something up, and must not cancel or
+  /// register with the same token.
+  struct cancellation_callback {
+    template <typename F> cancellation_callback(const cancellation & c, F && f) : token(c), f(std::forward<F>(f)) {
+      node.fire = &fire;
+      node.data = this;
+      if (token) token.get()->attach(&node);
+    }
+
+    ~cancellation_callback() { if (token) token.get()->detach(&node); }
+
+    /// @cond PRIVATE
+    cancellation_callback(const cancellation_callback &) = delete;
+    cancellation_callback & operator = (const cancellation_callback &) = delete;
+    /// @endcond
+
+  private:
+    detail::cancel_callback node;
+    cancellation token;
+    std::function<void()> f;
+
+    static void fire(detail::cancel_callback * c) noexcept {
+      static_cast<cancellation_callback *>(c->data)->f();
+    }
+  };
+
+  namespace this_fiber {
+    /// has the token of the current task been cancelled? Always false outside of a pool
+    bool cancelled() noexcept;
+  }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "memory/aligned_allocator.h"
+#include "sync.h"
+
+/// @file channel.h
+/// @brief @ref fib::channel
+
+namespace fib {
+
+  /// @brief A bounded multi-producer multi-consumer queue that suspends fibers when full or empty.
+  ///
+  /// Values are handed straight from sender to receiver when one is already waiting, skipping the buffer.
+  /// A capacity of zero makes every exchange a rendezvous. Moves of @p T happen under an internal spin lock,
+  /// so they should be cheap and must not throw.
+  template <typename T> struct channel {
+    static_assert(std::is_nothrow_move_constructible<T>::value && std::is_nothrow_move_assignable<T>::value,
+      "channel elements must be nothrow move constructible and assignable");
+
+    explicit channel(std::size_t capacity)
+      : items(capacity ? static_cast<T*>(memory::detail::allocate_aligned_memory(alignof(T) < 16 ? 16 : alignof(T), capacity * sizeof(T))) : nullptr)
+      , capacity(capacity), first(0), size(0), closed(false) {}
+
+    ~channel() {
+      while (size) {
+        items[first].~T();
+        first = (first + 1) % capacity;
+        --size;
+      }
+      memory::detail::deallocate_aligned_memory(items);
+    }
+
+    /// @cond PRIVATE
+    channel(const channel &) = delete;
+    channel & operator = (const channel &) = delete;
+    /// @endcond
+
+    /// Send @p value, waiting for room if need be. False, leaving @p value alone, if the channel is closed.
+    bool push(T && value) {
+      guard.lock();
+      if (try_push_locked(value)) return true;
+      if (closed) {
+        guard.unlock();
+        return false;
+      }
+      detail::waiter w;
+      w.slot = &value;
+      detail::block(w, senders, guard);
+      return w.ok;
+    }
+
+    bool push(const T & value) {
+      T copy(value);
+      return push(std::move(copy));
+    }
+
+    /// Send @p value if that can be done without waiting.
+    bool try_push(T && value) {
+      guard.lock();
+      if (try_push_locked(value)) return true;
+      guard.unlock();
+      return false;
+    }
+
+    /// Receive into @p value, waiting for something to arrive if need be. False once the channel is closed and drained.
+    bool pop(T & value) {
+      guard.lock();
+      if (try_pop_locked(value)) return true;
+      if (closed) {
+        guard.unlock();
+        return false;
+      }
+      detail::waiter w;
+      w.slot = &value;
+      detail::block(w, receivers, guard);
+      return w.ok;
+    }
+
+    /// Receive into @p value if that can be done without waiting.
+    bool try_pop(T & value) {
+      guard.lock();
+      if (try_pop_locked(value)) return true;
+      guard.unlock();
+      return false;
+    }
+
+    /// Refuse any further values. Waiting senders fail, and receivers fail once the buffer is drained.
+    void close() noexcept {
+      guard.lock();
+      closed = true;
+      detail::waiter * s = senders.pop_all(), * r = receivers.pop_all();
+      guard.unlock();
+      fail_all(s);
+      fail_all(r);
+    }
+
+  private:
+    // each of these releases the guard if and only if it succeeds
+
+    bool try_push_locked(T & value) {
+      if (closed) return false;
+      if (detail::waiter * r = receivers.pop()) {
+        // anybody waiting means the buffer is empty, so hand it straight over
+        *static_cast<T*>(r->slot) = std::move(value);
+        guard.unlock();
+        r->wake();
+        return true;
+      }
+      if (size == capacity) return false;
+      new (&items[(first + size) % capacity]) T(std::move(value));
+      ++size;
+      guard.unlock();
+      return true;
+    }
+
+    bool try_pop_locked(T & value) {
+      detail::waiter * s;
+      if (size) {
+        T & front = items[first];
+        value = std::move(front);
+        front.~T();
+        first = (first + 1) % capacity;
+        --size;
+        // a blocked sender can take the room we just made
+        if ((s = senders.pop()) != nullptr) {
+          new (&items[(first + size) % capacity]) T(std::move(*static_cast<T*>(s->slot)));
+          ++size;
+        }
+      } else if ((s = senders.pop()) != nullptr) {
+        value = std::move(*static_cast<T*>(s->slot)); // a rendezvous
+      } else return false;
+      guard.unlock();
+      if (s) s->wake();
+      return true;
+    }
+
+    static void fail_all(detail::waiter * w) noexcept {
+      while (w) {
+        detail::waiter * next = w->next;
+        w->ok = false;
+        w->wake();
+        w = next;
+      }
+    }
+
+    detail::spinlock guard;
+    detail::wait_queue senders;   ///< blocked on a full buffer, each with a value in its slot
+    detail::wait_queue receivers; ///< blocked on an empty buffer, each with somewhere to put a value in its slot
+    T * items;                    ///< ring buffer
+    std::size_t capacity;
+    std::size_t first;
+    std::size_t size;
+    bool closed;
+  };
+}
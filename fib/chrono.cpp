@@ -0,0 +1,74 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "chrono.h"
+#include "cpu.h"
+
+/// @file chrono.cpp
+/// @brief calibration for @ref fib::chrono::tsc_clock
+
+namespace fib {
+  namespace chrono {
+    const bool tsc_clock::is_steady;
+
+    /// @cond PRIVATE
+    namespace detail {
+      namespace {
+#ifdef FIB_TSC
+        /// how long to watch the counter against the steady clock when the processor won't tell us its rate
+        const std::chrono::milliseconds calibration_window(2);
+
+        std::int64_t steady_ns() noexcept {
+          return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /// read the steady clock, along with the counter at the same moment, taking the tightest of a few brackets
+        void sample(std::uint64_t & ticks, std::int64_t & ns) noexcept {
+          std::uint64_t best = ~std::uint64_t(0);
+          for (int i = 0; i < 5; ++i) {
+            std::uint64_t before = rdtsc();
+            std::int64_t t = steady_ns();
+            std::uint64_t after = rdtsc();
+            if (after - before < best) {
+              best = after - before;
+              ticks = before + (after - before) / 2;
+              ns = t;
+            }
+          }
+        }
+
+        /// the nominal counter rate from cpuid leaf 0x15, if the processor reports one
+        std::uint64_t reported_hz() noexcept {
+          if (__get_cpuid_max(0, nullptr) < 0x15) return 0;
+          unsigned denominator, numerator, crystal, d;
+          __cpuid(0x15, denominator, numerator, crystal, d);
+          if (denominator == 0 || numerator == 0 || crystal == 0) return 0;
+          return std::uint64_t(crystal) * numerator / denominator;
+        }
+#endif
+      }
+
+      tsc_calibration calibrate() noexcept {
+        tsc_calibration c = { false, 0, 0, 0 };
+#ifdef FIB_TSC
+        if (!cpu().invariant_tsc) return c;
+        sample(c.base_ticks, c.base_ns);
+        if (std::uint64_t hz = reported_hz()) c.scale = (std::uint64_t(1000000000) << 32) / hz;
+        else {
+          std::int64_t stop = c.base_ns + std::chrono::duration_cast<std::chrono::nanoseconds>(calibration_window).count();
+          while (steady_ns() < stop) {}
+          std::uint64_t ticks = 0;
+          std::int64_t ns = 0;
+          sample(ticks, ns);
+          if (ticks <= c.base_ticks) return c;
+          c.scale = std::uint64_t((std::uint64_t(ns - c.base_ns) << 32) / (ticks - c.base_ticks));
+        }
+        c.usable = c.scale != 0;
+#endif
+        return c;
+      }
+    }
+    /// @endcond
+  }
+}
@@ -1,13 +1,90 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <type_traits>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+/// @brief defined when @ref fib::chrono::tsc_clock can read the time stamp counter directly
+#define FIB_TSC
+#endif
+
 /// @file chrono.h
-/// @brief Portable support for @p std::chrono extras
+/// @brief Portable support for @p std::chrono extras, and @ref fib::chrono::tsc_clock
 
 namespace fib {
   namespace chrono {
+    /// @cond PRIVATE
+    namespace detail {
+      /// maps time stamp counter readings onto @p std::chrono::steady_clock nanoseconds
+      struct tsc_calibration {
+        bool usable;              ///< false until calibrated, and forever on machines without an invariant counter
+        std::uint64_t base_ticks; ///< a counter reading
+        std::int64_t base_ns;     ///< the steady clock, in nanoseconds, at the moment of that reading
+        std::uint64_t scale;      ///< nanoseconds per tick as a 32.32 fixed point number
+      };
+
+      /// watch the counter against the steady clock. may spin for a couple of milliseconds
+      tsc_calibration calibrate() noexcept;
+
+      /// calibrated once, on first use, rather than holding up static initialization
+      inline const tsc_calibration & tsc() noexcept {
+        static const tsc_calibration c = calibrate();
+        return c;
+      }
+
+#ifdef FIB_TSC
+      /// read the time stamp counter, without dragging @p <x86intrin.h> into everyone's headers
+      inline std::uint64_t rdtsc() noexcept { return __builtin_ia32_rdtsc(); }
+#endif
+    }
+    /// @endcond
+
+    /// @brief A cheap monotonic clock backed by the processor's time stamp counter.
+    ///
+    /// Reading it costs an @p rdtsc and a multiply, with no trip through the kernel's clocksource code, which
+    /// on some virtual machines is a system call. The counter is only trusted when @p cpuid reports it as
+    /// invariant, and is calibrated against @p std::chrono::steady_clock so the two share an epoch. That happens
+    /// the first time the clock is read, which may take a couple of milliseconds if the processor doesn't report
+    /// its counter's rate. Everywhere else this simply reads @p std::chrono::steady_clock.
+    struct tsc_clock {
+      typedef std::chrono::nanoseconds duration;
+      typedef duration::rep rep;
+      typedef duration::period period;
+      typedef std::chrono::time_point<tsc_clock> time_point;
+      static const bool is_steady = true;
+
+      static time_point now() noexcept {
+#ifdef FIB_TSC
+        if (detail::tsc().usable) return from_ticks(detail::rdtsc());
+#endif
+        return from_steady(std::chrono::steady_clock::now());
+      }
+
+      /// Is @ref now reading the time stamp counter?
+      static bool uses_tsc() noexcept { return detail::tsc().usable; }
+
+#ifdef FIB_TSC
+      /// convert a raw time stamp counter reading. only meaningful if @ref uses_tsc
+      static time_point from_ticks(std::uint64_t ticks) noexcept {
+        const detail::tsc_calibration & c = detail::tsc();
+        __int128 elapsed = __int128(std::int64_t(ticks - c.base_ticks)) * __int128(c.scale);
+        return time_point(duration(c.base_ns + std::int64_t(elapsed >> 32)));
+      }
+#endif
+
+      static time_point from_steady(std::chrono::steady_clock::time_point t) noexcept {
+        return time_point(std::chrono::duration_cast<duration>(t.time_since_epoch()));
+      }
+
+      static std::chrono::steady_clock::time_point to_steady(time_point t) noexcept {
+        return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(t.time_since_epoch()));
+      }
+    };
+
+    /// The clock the scheduler keeps time by: deal delays, timers and fiber sleeps.
+    typedef tsc_clock clock;
+
     /// @cond PRIVATE
     namespace detail {
       template <class T> struct is_duration : std::false_type {};
@@ -16,6 +93,10 @@ namespace fib {
       template <class To, class Rep, class Period> constexpr To floor_helper(const std::chrono::duration<Rep, Period>& d, To t) {
         return t > d ?  t - To{1} : t;
       }
+
+      template <class To, class Rep, class Period> constexpr To ceil_helper(const std::chrono::duration<Rep, Period>& d, To t) {
+        return t < d ?  t + To{1} : t;
+      }
     }
     /// @endcond
 
@@ -25,5 +106,12 @@ namespace fib {
     template <class To, class Rep, class Period, class = typename std::enable_if<detail::is_duration<To>{}>::type> constexpr To floor(const std::chrono::duration<Rep, Period>& d) {
       return detail::floor_helper<To,Rep,Period>(d, std::chrono::duration_cast<To>(d));
     }
+
+    /// @brief round a duration up towards the ceiling to form an integral duration
+    ///
+    /// Portable support for c++17's @p std::chrono::ceil
+    template <class To, class Rep, class Period, class = typename std::enable_if<detail::is_duration<To>{}>::type> constexpr To ceil(const std::chrono::duration<Rep, Period>& d) {
+      return detail::ceil_helper<To,Rep,Period>(d, std::chrono::duration_cast<To>(d));
+    }
   }
 }
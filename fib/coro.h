@@ -0,0 +1,372 @@
+#pragma once
+
+/// @file coro.h
+/// @brief @ref fib::coro, a stackless c++20 coroutine front end
+///
+/// Only available when building with c++20 coroutines, e.g. with the @p ENABLE_COROUTINES cmake option.
+/// Defines @p FIB_COROUTINES when it is.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define FIB_COROUTINES
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "fib/chrono.h"
+#include "fib/future.h"
+#include "fib/generator.hpp"
+#include "fib/memory/arena.h"
+#include "fib/worker.h"
+
+/// @namespace fib::coro
+/// @brief stackless coroutines scheduled on @ref fib::pool workers
+///
+/// Named apart from @ref fib::task, which is the type-erased unit of work the scheduler runs.
+namespace fib::coro {
+
+  namespace detail {
+    /// @brief Coroutine frames come from the arena of the worker that creates them, or the aligned heap elsewhere.
+    ///
+    /// The arena is remembered in a header in front of the frame, as frames may be freed on another worker.
+    struct frame_allocated {
+      static const std::size_t header = memory::arena::granularity;
+
+      static void * operator new(std::size_t n) {
+        memory::arena * a = memory::arena::current();
+        void * p = a ? a->allocate(n + header) : memory::detail::allocate_aligned_memory(header, n + header);
+        *static_cast<memory::arena**>(p) = a;
+        return static_cast<char*>(p) + header;
+      }
+
+      static void operator delete(void * p, std::size_t n) noexcept {
+        char * base = static_cast<char*>(p) - header;
+        memory::arena * a = *reinterpret_cast<memory::arena**>(base);
+        if (a) a->deallocate(base, n + header);
+        else memory::detail::deallocate_aligned_memory(base);
+      }
+    };
+
+    /// @brief spawned to pick a coroutine back up on a worker
+    ///
+    /// Like a suspended fiber, this is queued without a token, so it is never dropped: that would leak the frame
+    /// and strand whoever awaits it. It carries the token of the task it resumes instead, and puts it back on the worker.
+    struct resumption {
+      std::coroutine_handle<> h;
+      cancellation token;
+      void operator ()(worker & w) const {
+        w.token = token.get();
+        h.resume();
+      }
+    };
+
+    /// queue a resumption of @p h on @p w at the priority, and under the token, of the task it is running
+    inline fib::task resume_later(worker & w, std::coroutine_handle<> h) {
+      fib::task t(w.arena, resumption { h, cancellation(fib::detail::share(w.token)) });
+      t.get()->level = w.level;
+      return t;
+    }
+
+    /// where the result of a @ref task goes
+    template <typename T> struct result {
+      std::optional<T> value;
+      std::exception_ptr error;
+      template <typename U> void return_value(U && u) { value.emplace(std::forward<U>(u)); }
+      T get() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+      }
+    };
+
+    template <> struct result<void> {
+      std::exception_ptr error;
+      void return_void() noexcept {}
+      void get() {
+        if (error) std::rethrow_exception(error);
+      }
+    };
+  }
+
+  /// @brief A lazily started coroutine producing a @p T.
+  ///
+  /// Nothing runs until the task is awaited, at which point control transfers straight into it, and straight
+  /// back to the awaiter when it finishes, without a trip through the scheduler. Hand a task to @ref spawn
+  /// or @ref submit to start it on a worker and get a @ref fib::future for its result.
+  template <typename T = void> struct task {
+    struct promise_type : detail::frame_allocated, detail::result<T> {
+      std::coroutine_handle<> continuation;
+
+      task get_return_object() noexcept { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+      std::suspend_always initial_suspend() noexcept { return {}; }
+
+      struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+          std::coroutine_handle<> c = h.promise().continuation;
+          return c ? c : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+
+      final_awaiter final_suspend() noexcept { return {}; }
+      void unhandled_exception() noexcept { this->error = std::current_exception(); }
+    };
+
+    task() noexcept = default;
+    task(task && that) noexcept : h(std::exchange(that.h, nullptr)) {}
+    task & operator = (task && that) noexcept {
+      std::swap(h, that.h);
+      return *this;
+    }
+    ~task() { if (h) h.destroy(); }
+
+    /// @cond PRIVATE
+    task(const task &) = delete;
+    task & operator = (const task &) = delete;
+    /// @endcond
+
+    bool valid() const noexcept { return bool(h); }
+
+    /// run to completion, then carry on with the awaiter
+    auto operator co_await() && noexcept {
+      struct awaiter {
+        std::coroutine_handle<promise_type> h;
+        bool await_ready() const noexcept { return h.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+          h.promise().continuation = awaiting;
+          return h;
+        }
+        T await_resume() { return h.promise().get(); }
+      };
+      return awaiter { h };
+    }
+
+  private:
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h(h) {}
+    std::coroutine_handle<promise_type> h;
+  };
+
+  /// @cond PRIVATE
+  namespace detail {
+    /// a coroutine nobody waits for, which frees itself when it finishes
+    struct detached {
+      struct promise_type : frame_allocated {
+        detached get_return_object() noexcept { return detached { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+      };
+      std::coroutine_handle<promise_type> h;
+    };
+
+    template <typename T> detached fulfil(task<T> t, fib::promise<T> p) {
+      try {
+        if constexpr (std::is_void_v<T>) {
+          co_await std::move(t);
+          p.set_value();
+        } else p.set_value(co_await std::move(t));
+      } catch (...) {
+        p.set_exception(std::current_exception());
+      }
+    }
+  }
+  /// @endcond
+
+  /// Start @p t on @p w, at the priority and under the token of the current task, and get a future for its result.
+  /// Cancelling the token doesn't drop the coroutine, which should poll @ref this_fiber::cancelled.
+  template <typename T> fib::future<T> spawn(worker & w, task<T> t) {
+    fib::promise<T> p;
+    fib::future<T> result = p.get_future();
+    detail::detached d = detail::fulfil(std::move(t), std::move(p));
+    try {
+      detail::resumption r { d.h, cancellation::current() };
+      if (w.p.spawning.load(std::memory_order_relaxed) == spawn_policy::help_first) w.spawn(cancellation(), std::move(r));
+      else w.spawn(spawn_policy::work_first, std::move(r));
+    } catch (...) {
+      d.h.destroy();
+      throw;
+    }
+    return result;
+  }
+
+  /// Start @p t on @p p, as with @ref pool::submit, and get a future for its result. Safe to call from any thread.
+  template <typename T> fib::future<T> submit(pool & p, task<T> t, fib::priority level = priority::normal) {
+    fib::promise<T> pr;
+    fib::future<T> result = pr.get_future();
+    detail::detached d = detail::fulfil(std::move(t), std::move(pr));
+    try {
+      p.submit(detail::resumption { d.h, cancellation() }, level);
+    } catch (...) {
+      d.h.destroy();
+      throw;
+    }
+    return result;
+  }
+
+  /// Let everything else queued locally at our priority run first. Doesn't suspend outside of a pool.
+  inline auto yield() noexcept {
+    struct awaiter {
+      bool await_ready() const noexcept { return worker::current() == nullptr; }
+      void await_suspend(std::coroutine_handle<> h) {
+        worker & w = *worker::current();
+        w.defer(detail::resume_later(w, h));
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter {};
+  }
+
+  /// Move to @p p, carrying on as a freshly submitted task on one of its workers.
+  inline auto schedule_on(pool & p, fib::priority level = priority::normal) noexcept {
+    struct awaiter {
+      pool & p;
+      fib::priority level;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { p.submit(detail::resumption { h, cancellation::current() }, level); }
+      void await_resume() const noexcept {}
+    };
+    return awaiter { p, level };
+  }
+
+  /// Carry on once @p deadline has passed, on the current worker's timing wheel. Outside of a pool this blocks the thread.
+  inline auto sleep_until(chrono::clock::time_point deadline) noexcept {
+    struct awaiter {
+      chrono::clock::time_point deadline;
+      bool await_ready() const noexcept {
+        if (worker::current() != nullptr) return false;
+        std::this_thread::sleep_until(deadline);
+        return true;
+      }
+      void await_suspend(std::coroutine_handle<> h) {
+        worker & w = *worker::current();
+        w.schedule_at(deadline, detail::resume_later(w, h));
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter { deadline };
+  }
+
+  template <typename Rep, typename Period> auto sleep_for(const std::chrono::duration<Rep, Period> & delay) noexcept {
+    return sleep_until(chrono::clock::now() + chrono::ceil<chrono::clock::duration>(delay));
+  }
+
+  /// @brief A pull based sequence written as a coroutine with @p co_yield.
+  ///
+  /// The stackless counterpart of @ref fib::enumerator: a frame of tens of bytes from the worker's arena instead of
+  /// a whole stack. Works with range-based for, and as an @ref fib::enumerator_expr, so @p map, @p where and @p then
+  /// compose with the other enumerators. Those take the generator over, as it can only be walked once.
+  template <typename T> struct generator : enumerator_expr<generator<T>, T> {
+    struct promise_type : detail::frame_allocated {
+      const T * current = nullptr;
+      std::exception_ptr error;
+
+      generator get_return_object() noexcept { return generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+      // the yielded value outlives the suspension, as it lasts until the end of the co_yield expression
+      std::suspend_always yield_value(const T & value) noexcept {
+        current = std::addressof(value);
+        return {};
+      }
+      void return_void() noexcept {}
+      void unhandled_exception() noexcept { error = std::current_exception(); }
+      void await_transform() = delete; // generators are synchronous
+    };
+
+    struct iterator {
+      typedef std::input_iterator_tag iterator_category;
+      typedef std::ptrdiff_t difference_type;
+      typedef T value_type;
+      typedef const T & reference;
+      typedef const T * pointer;
+
+      std::coroutine_handle<promise_type> h;
+
+      reference operator * () const noexcept { return *h.promise().current; }
+      pointer operator -> () const noexcept { return h.promise().current; }
+      iterator & operator ++ () {
+        advance(h);
+        if (h.done()) h = nullptr;
+        return *this;
+      }
+      void operator ++ (int) { ++*this; }
+      bool operator == (const iterator & that) const noexcept { return h == that.h; }
+      bool operator != (const iterator & that) const noexcept { return h != that.h; }
+    };
+
+    generator() noexcept = default;
+    generator(generator && that) noexcept : h(std::exchange(that.h, nullptr)) {}
+    generator & operator = (generator && that) noexcept {
+      std::swap(h, that.h);
+      return *this;
+    }
+    ~generator() { if (h) h.destroy(); }
+
+    /// @cond PRIVATE
+    generator(const generator &) = delete;
+    generator & operator = (const generator &) = delete;
+    /// @endcond
+
+    iterator begin() {
+      if (!h) return end();
+      advance(h);
+      return h.done() ? end() : iterator { h };
+    }
+
+    iterator end() noexcept { return iterator { nullptr }; }
+
+    template <typename F> void foreach(F f) {
+      for (const T & a : *this) f(a);
+    }
+
+    template <typename F> auto map(F f) -> fib::detail::map_enumerator<generator, F, T, decltype(f(std::declval<T>()))> {
+      return fib::detail::map_enumerator<generator, F, T, decltype(f(std::declval<T>()))>(std::move(*this), f);
+    }
+
+    template <typename P> fib::detail::where_enumerator<generator, P, T> where(P p) {
+      return fib::detail::where_enumerator<generator, P, T>(std::move(*this), p);
+    }
+
+    template <typename F> auto then(F f) -> fib::detail::then_enumerator<generator, F, T, decltype(f(std::declval<T>()))> {
+      return fib::detail::then_enumerator<generator, F, T, decltype(f(std::declval<T>()))>(std::move(*this), f);
+    }
+
+  private:
+    explicit generator(std::coroutine_handle<promise_type> h) noexcept : h(h) {}
+
+    static void advance(std::coroutine_handle<promise_type> h) {
+      h.resume();
+      if (h.done() && h.promise().error) std::rethrow_exception(std::exchange(h.promise().error, nullptr));
+    }
+
+    std::coroutine_handle<promise_type> h;
+  };
+}
+
+namespace fib {
+  /// @brief Await a @ref future from a coroutine.
+  ///
+  /// The coroutine is picked back up as a task on whichever worker completes the future.
+  template <typename T> auto operator co_await(future<T> && f) noexcept {
+    struct awaiter {
+      future<T> source;
+      future<T> ready;
+      bool await_ready() const { return source.is_ready(); }
+      void await_suspend(std::coroutine_handle<> h) {
+        source.then([this, h](future<T> r) {
+          ready = std::move(r);
+          h.resume();
+        });
+      }
+      T await_resume() { return ready.valid() ? ready.get() : source.get(); }
+    };
+    return awaiter { std::move(f), future<T>() };
+  }
+}
+
+#endif
@@ -0,0 +1,43 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "cpu.h"
+
+/// @file cpu.cpp
+/// @brief @p cpuid based implementation of @ref fib::cpu
+
+namespace fib {
+  /// @cond PRIVATE
+  namespace {
+    cpu_features detect() noexcept {
+      cpu_features f = { false, false, false, false };
+#if defined(__x86_64__) || defined(__i386__)
+      unsigned a, b, c, d;
+      if (__get_cpuid_max(0, nullptr) >= 7) {
+        __cpuid_count(7, 0, a, b, c, d);
+        f.hle = (b >> 4) & 1;
+        // microcode updates for TAA may leave the RTM bit set, but force every transaction to abort
+        bool always_aborts = (d >> 11) & 1;
+        f.rtm = ((b >> 11) & 1) && !always_aborts;
+      }
+      unsigned ext = __get_cpuid_max(0x80000000, nullptr);
+      if (ext >= 0x80000001) {
+        __cpuid(0x80000001, a, b, c, d);
+        f.rdtscp = (d >> 27) & 1;
+      }
+      if (ext >= 0x80000007) {
+        __cpuid(0x80000007, a, b, c, d);
+        f.invariant_tsc = (d >> 8) & 1;
+      }
+#endif
+      return f;
+    }
+  }
+  /// @endcond
+
+  const cpu_features & cpu() noexcept {
+    static const cpu_features features = detect();
+    return features;
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+/// @file cpu.h
+/// @brief runtime processor feature detection
+
+namespace fib {
+  /// @brief Processor features that we select code paths by at runtime.
+  ///
+  /// Detected once via @p cpuid, so a single binary can use them where present and fall back elsewhere.
+  struct cpu_features {
+    bool rtm;           ///< restricted transactional memory is present and hasn't been disabled by microcode
+    bool hle;           ///< hardware lock elision prefixes
+    bool rdtscp;        ///< the @p rdtscp instruction
+    bool invariant_tsc; ///< the time stamp counter ticks at a constant rate regardless of power state
+  };
+
+  /// The features of the processor we are running on.
+  const cpu_features & cpu() noexcept;
+}
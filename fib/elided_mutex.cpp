@@ -0,0 +1,141 @@
+#include <thread>
+
+#include "elided_mutex.h"
+
+/// @file elided_mutex.cpp
+/// @brief the transactional and plain paths of @ref fib::elided_mutex, and the startup dispatch between them
+
+namespace fib {
+  /// @cond PRIVATE
+  namespace {
+    /// spin-wait hint
+    FIB_ATTRIBUTE_ALWAYS_INLINE inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+
+#ifdef FIB_RTM
+    const std::uint32_t abort_busy = 0xff; ///< @ref rtm_abort code used when the lock is held
+#endif
+
+    FIB_ATTRIBUTE_ALWAYS_INLINE inline void count(std::atomic<std::uint64_t> & c) noexcept {
+#ifdef FIB_ELISION_STATS
+      c.fetch_add(1, std::memory_order_relaxed);
+#else
+      (void) c;
+#endif
+    }
+  }
+  /// @endcond
+
+  // Start out pointing at resolvers, so locks taken during static initialization still work.
+  std::atomic<elided_mutex::path> elided_mutex::lock_impl(elided_mutex::resolve_lock);
+  std::atomic<elided_mutex::path> elided_mutex::unlock_impl(elided_mutex::resolve_unlock);
+
+  void elided_mutex::resolve() noexcept {
+    // every thread that races through here stores the same values
+#ifdef FIB_RTM
+    if (rtm_supported()) {
+      lock_impl.store(lock_transactional, std::memory_order_relaxed);
+      unlock_impl.store(unlock_transactional, std::memory_order_relaxed);
+      return;
+    }
+#endif
+    lock_impl.store(lock_plain, std::memory_order_relaxed);
+    unlock_impl.store(unlock_plain, std::memory_order_relaxed);
+  }
+
+  /// @cond PRIVATE
+  namespace {
+    // bind the paths before main, rather than on first use
+    struct elision_resolver {
+      elision_resolver() { elided_mutex::eliding(); }
+    } resolve_at_startup;
+  }
+  /// @endcond
+
+  bool elided_mutex::eliding() noexcept {
+    if (lock_impl.load(std::memory_order_relaxed) == resolve_lock) resolve();
+#ifdef FIB_RTM
+    return lock_impl.load(std::memory_order_relaxed) == lock_transactional;
+#else
+    return false;
+#endif
+  }
+
+  void elided_mutex::resolve_lock(elided_mutex & m) {
+    resolve();
+    lock_impl.load(std::memory_order_relaxed)(m);
+  }
+
+  void elided_mutex::resolve_unlock(elided_mutex & m) {
+    resolve();
+    unlock_impl.load(std::memory_order_relaxed)(m);
+  }
+
+  void elided_mutex::lock_plain(elided_mutex & m) {
+    for (int spins = 0; !m.try_lock(); ++spins) {
+      if (spins < 64) cpu_relax();
+      else std::this_thread::yield();
+    }
+  }
+
+  void elided_mutex::unlock_plain(elided_mutex & m) {
+    m.locked.store(false, std::memory_order_release);
+  }
+
+#ifdef FIB_RTM
+  void elided_mutex::lock_transactional(elided_mutex & m) {
+    if (!m.elide()) lock_plain(m);
+  }
+
+  void elided_mutex::unlock_transactional(elided_mutex & m) {
+    if (!m.locked.load(std::memory_order_relaxed) && rtm_test()) {
+      rtm_end();
+      count(m.stats.commits);
+      // elision is paying off again. only write when there is something to forget: this shares a line with the lock word
+      int p = m.penalty.load(std::memory_order_relaxed);
+      if (p != 0) m.penalty.store(p >> 1, std::memory_order_relaxed);
+    } else {
+      m.locked.store(false, std::memory_order_release);
+    }
+  }
+
+  // try to enter the critical section transactionally. false means we should take the lock.
+  bool elided_mutex::elide() noexcept {
+    if (skip.load(std::memory_order_relaxed) > 0) {
+      skip.fetch_sub(1, std::memory_order_relaxed);
+      return false;
+    }
+    int backoff = 1;
+    for (int attempt = 0; attempt < policy.retries; ++attempt) {
+      std::uint32_t status = rtm_begin();
+      if (status == rtm_started) {
+        if (!locked.load(std::memory_order_relaxed)) return true; // lock word is now in our read set
+        rtm_abort(abort_busy);
+      }
+      if ((status & rtm_status_explicit) && rtm_status_code(status) == abort_busy) {
+        count(stats.busy);
+        while (locked.load(std::memory_order_relaxed)) cpu_relax();
+      } else if (status & rtm_status_capacity) {
+        count(stats.capacity);
+        break;
+      } else if (status & (rtm_status_conflict | rtm_status_retry)) {
+        count(stats.conflicts);
+        for (int i = 0; i < backoff; ++i) cpu_relax();
+        if (backoff < policy.backoff_limit) backoff <<= 1;
+      } else {
+        count(stats.other);
+      }
+    }
+    // elision isn't paying off here, so stop trying for a while
+    int p = penalty.load(std::memory_order_relaxed);
+    p = p == 0 ? 1 : p < policy.skip_limit ? p << 1 : p;
+    penalty.store(p, std::memory_order_relaxed);
+    skip.store(p, std::memory_order_relaxed);
+    count(stats.fallbacks);
+    return false;
+  }
+#endif
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "fib/attribute.h"
+#include "fib/rtm.h"
+
+/// @file elided_mutex.h
+/// @brief @ref fib::elided_mutex and transactional multi-word updates
+
+/// @addtogroup rtm
+/// @{
+
+namespace fib {
+
+  /// @brief Counters describing how well lock elision is working out.
+  ///
+  /// Only maintained when compiled with @p FIB_ELISION_STATS, as bumping a shared counter on every
+  /// acquisition would put back the very cache line traffic elision is meant to remove.
+  struct elision_stats {
+    std::atomic<std::uint64_t> commits;   ///< critical sections that committed transactionally
+    std::atomic<std::uint64_t> conflicts; ///< aborts due to another logical processor touching our data
+    std::atomic<std::uint64_t> capacity;  ///< aborts due to the transaction outgrowing the hardware buffers
+    std::atomic<std::uint64_t> busy;      ///< aborts because somebody held the lock for real
+    std::atomic<std::uint64_t> other;     ///< every other sort of abort
+    std::atomic<std::uint64_t> fallbacks; ///< critical sections that ended up taking the lock
+
+    elision_stats() noexcept { reset(); }
+
+    void reset() noexcept {
+      commits.store(0, std::memory_order_relaxed);
+      conflicts.store(0, std::memory_order_relaxed);
+      capacity.store(0, std::memory_order_relaxed);
+      busy.store(0, std::memory_order_relaxed);
+      other.store(0, std::memory_order_relaxed);
+      fallbacks.store(0, std::memory_order_relaxed);
+    }
+
+    /// total number of aborted transactions
+    std::uint64_t aborts() const noexcept {
+      return conflicts.load(std::memory_order_relaxed) + capacity.load(std::memory_order_relaxed)
+           + busy.load(std::memory_order_relaxed) + other.load(std::memory_order_relaxed);
+    }
+
+    /// fraction of transactions started that aborted
+    double abort_rate() const noexcept {
+      std::uint64_t a = aborts(), c = commits.load(std::memory_order_relaxed);
+      return a + c == 0 ? 0.0 : double(a) / double(a + c);
+    }
+  };
+
+  /// @brief How hard an @ref elided_mutex tries before taking the lock for real.
+  struct elision_policy {
+    int retries;        ///< transactional attempts per acquisition
+    int backoff_limit;  ///< cap on the exponential pause backoff after a conflict, in pause instructions
+    int skip_limit;     ///< cap on the number of acquisitions that skip elision after it keeps failing
+
+    elision_policy(int retries = 5, int backoff_limit = 64, int skip_limit = 64) noexcept
+      : retries(retries), backoff_limit(backoff_limit), skip_limit(skip_limit) {}
+  };
+
+  /// @brief A spin lock that elides itself with RTM when it can.
+  ///
+  /// Critical sections first run as hardware transactions that merely read the lock word, so threads
+  /// touching disjoint data never serialize. Aborts are classified by their status:
+  ///
+  /// * @ref rtm_status_capacity will never fit, so we take the lock immediately.
+  /// * @ref rtm_status_conflict and @ref rtm_status_retry back off exponentially and retry.
+  /// * an explicit abort because the lock was held waits for it to be released and then retries.
+  ///
+  /// When retries run out the lock is taken for real, and elision is skipped for a growing number of
+  /// subsequent acquisitions, so a mutex that never elides successfully costs about what a spin lock does.
+  /// Each committed transaction halves that number again, so a burst of contention is forgotten once it passes.
+  ///
+  /// Whether to elide at all is decided once, at startup, from @ref rtm_supported. @ref lock and @ref unlock
+  /// call through pointers bound to either the transactional or the plain spin lock path, so machines
+  /// without working RTM pay no per-call test for it.
+  ///
+  /// Meets the standard @p Lockable requirements, so it works with @p std::lock_guard.
+  struct elided_mutex {
+    elision_policy policy; ///< retry tuning
+    elision_stats stats;   ///< abort rate counters, see @ref elision_stats
+
+    explicit elided_mutex(const elision_policy & policy = elision_policy()) noexcept : policy(policy) {
+      locked.store(false, std::memory_order_relaxed);
+      skip.store(0, std::memory_order_relaxed);
+      penalty.store(0, std::memory_order_relaxed);
+    }
+
+    /// @cond PRIVATE
+    elided_mutex(const elided_mutex &) = delete;
+    elided_mutex & operator = (const elided_mutex &) = delete;
+    /// @endcond
+
+    void lock() noexcept { lock_impl.load(std::memory_order_relaxed)(*this); }
+
+    bool try_lock() noexcept {
+      return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() noexcept { unlock_impl.load(std::memory_order_relaxed)(*this); }
+
+    /// Is somebody holding the lock for real? Transactional holders are invisible.
+    bool is_locked() const noexcept {
+      return locked.load(std::memory_order_relaxed);
+    }
+
+    /// Are critical sections being elided on this machine?
+    static bool eliding() noexcept;
+
+  private:
+    std::atomic<bool> locked;
+    std::atomic<int> skip;    ///< acquisitions left to run without elision
+    std::atomic<int> penalty; ///< how many acquisitions to skip the next time elision fails outright. halved by every commit
+
+    typedef void (*path)(elided_mutex &);
+    static std::atomic<path> lock_impl;   ///< bound at startup. relaxed, as every thread that binds it stores the same value
+    static std::atomic<path> unlock_impl; ///< bound at startup
+
+    static void resolve() noexcept;
+    static void resolve_lock(elided_mutex & m);
+    static void resolve_unlock(elided_mutex & m);
+    static void lock_plain(elided_mutex & m);
+    static void unlock_plain(elided_mutex & m);
+#ifdef FIB_RTM
+    static void lock_transactional(elided_mutex & m);
+    static void unlock_transactional(elided_mutex & m);
+    bool elide() noexcept;
+#endif
+  };
+
+  /// @brief Run @p f atomically with respect to every other critical section guarded by @p m.
+  ///
+  /// Where RTM is available this executes as a single hardware transaction, so several words can be
+  /// updated at once without any thread ever observing the lock held.
+  template <typename F> auto atomically(elided_mutex & m, F && f) -> decltype(f()) {
+    std::lock_guard<elided_mutex> guard(m);
+    return f();
+  }
+
+  /// @brief Multi-word compare-and-swap.
+  ///
+  /// If every @p words[i] holds @p expected[i], store every @p desired[i] and return true. Otherwise change
+  /// nothing and return false. The update is atomic with respect to other users of @p m, so every writer
+  /// of these words should go through @p m. Individual words may still be read with plain atomic loads.
+  template <typename T, std::size_t N>
+  bool multi_cas(elided_mutex & m, std::atomic<T> * const (&words)[N], const T (&expected)[N], const T (&desired)[N]) {
+    return atomically(m, [&]() -> bool {
+      for (std::size_t i = 0; i < N; ++i)
+        if (words[i]->load(std::memory_order_relaxed) != expected[i]) return false;
+      for (std::size_t i = 0; i < N; ++i)
+        words[i]->store(desired[i], std::memory_order_relaxed);
+      return true;
+    });
+  }
+}
+
+/// @}
@@ -0,0 +1,161 @@
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "cancel.h"
+#include "fiber.h"
+#include "trace.h"
+#include "worker.h"
+
+/// @file fiber.cpp
+/// @brief switching between fibers
+///
+/// A worker's scheduler always runs on a fiber. A task that suspends doesn't wait for anything itself: it jumps to
+/// a fresh fiber that carries on scheduling, and becomes an ordinary task node that resumes it when run. Resuming
+/// abandons whichever fiber was doing the scheduling, which the resumed fiber then recycles.
+
+namespace fib {
+  /// @cond PRIVATE
+  namespace {
+    /// passed to a fiber when we first jump to it
+    struct start_message {
+      void (*callback)(void *, detail::fiber *);
+      void * data;
+      detail::fiber * suspended; ///< the fiber that just suspended, to hand to the callback
+    };
+  }
+  /// @endcond
+
+  void detail::fiber::run(worker & w) {
+    fiber * from = w.running;
+    w.running = this;
+    // the resumed task picks its slice back up on the other side
+    trace::end(trace::what::task);
+    trace::instant(trace::what::resume);
+    // no coming back: whoever resumes us next will be on some other fiber, and this one is recycled by the fiber we resume
+    boost::context::detail::jump_fcontext(context, from);
+  }
+
+  void worker::entry(boost::context::detail::transfer_t from) {
+    if (from.data == nullptr) current()->home = from.fctx; // started by run()
+    else {
+      // the callback may publish the suspended fiber, after which it can be resumed at any moment, so copy what we need first
+      start_message m = *static_cast<start_message *>(from.data);
+      m.suspended->context = from.fctx;
+      m.callback(m.data, m.suspended);
+    }
+    loop();
+  }
+
+  void worker::suspend_with(void (*callback)(void *, detail::fiber *), void * data) {
+    worker & w = *current();
+    detail::fiber * self = w.running;
+    self->level = w.level;
+    detail::cancel_state * token = w.token; // owned by the task we're running, which lives on this stack
+    detail::fiber * next = w.fresh_fiber();
+    w.running = next;
+    start_message m = { callback, data, self };
+    trace::end(trace::what::task);
+    trace::instant(trace::what::suspend);
+    boost::context::detail::transfer_t from = boost::context::detail::jump_fcontext(next->context, &m);
+    // resumed, quite possibly on a different worker
+    trace::begin(trace::what::task, int(self->level));
+    worker & v = *current();
+    v.running = self;
+    v.token = token;
+    v.recycle(static_cast<detail::fiber *>(from.data));
+  }
+
+  detail::fiber * worker::fresh_fiber() {
+    detail::fiber * f;
+    if (spare.empty()) f = p.make_fiber();
+    else {
+      f = spare.back();
+      spare.pop_back();
+    }
+    std::size_t used = std::size_t(static_cast<char *>(f->stack.sp) - reinterpret_cast<char *>(f));
+    f->context = boost::context::detail::make_fcontext(f, f->stack.size - used, &entry);
+    return f;
+  }
+
+  void worker::recycle(detail::fiber * f) noexcept {
+    if (spare.size() < spare_limit) {
+      try {
+        spare.push_back(f);
+        return;
+      } catch (...) {}
+    }
+    p.free_fiber(f);
+  }
+
+  detail::fiber * pool::make_fiber() {
+    boost::context::stack_context stack = stacks.allocate();
+    // the record goes at the very top of the stack, and the stack proper grows down from just below it
+    std::uintptr_t top = (reinterpret_cast<std::uintptr_t>(stack.sp) - sizeof(detail::fiber)) & ~std::uintptr_t(63);
+    detail::fiber * f = new (reinterpret_cast<void *>(top)) detail::fiber(stack);
+    std::lock_guard<std::mutex> lock(fibers_lock);
+    f->next_fiber = fibers;
+    if (fibers != nullptr) fibers->prev_fiber = f;
+    fibers = f;
+    return f;
+  }
+
+  void pool::free_fiber(detail::fiber * f) noexcept {
+    {
+      std::lock_guard<std::mutex> lock(fibers_lock);
+      if (f->prev_fiber != nullptr) f->prev_fiber->next_fiber = f->next_fiber;
+      else fibers = f->next_fiber;
+      if (f->next_fiber != nullptr) f->next_fiber->prev_fiber = f->prev_fiber;
+    }
+    boost::context::stack_context stack = f->stack;
+    f->~fiber();
+    stacks.deallocate(stack);
+  }
+
+  namespace this_fiber {
+    void yield() {
+      if (worker::current() == nullptr) {
+        std::this_thread::yield();
+        return;
+      }
+      worker::suspend([](detail::fiber * self) {
+        worker::current()->defer(task(self));
+      });
+    }
+
+    void sleep_until(chrono::clock::time_point deadline) {
+      worker * w = worker::current();
+      if (w == nullptr) {
+        std::this_thread::sleep_until(deadline);
+        return;
+      }
+      detail::cancel_state * token = w->token;
+      if (token == nullptr) {
+        worker::suspend([deadline](detail::fiber * self) {
+          worker::current()->schedule_at(deadline, task(self));
+        });
+        return;
+      }
+      if (detail::dead(token)) return;
+      // cancellation takes the fiber back from the alarm, and resumes it early
+      struct sleeper : detail::cancel_callback {
+        timer alarm;
+        pool * home;
+      } s;
+      s.home = &w->p;
+      s.fire = [](detail::cancel_callback * c) {
+        sleeper & s = *static_cast<sleeper *>(c);
+        pool * home = s.home;
+        task t = s.alarm.revoke();
+        if (t) home->post(std::move(t)); // we may be gone as soon as this happens
+      };
+      worker::suspend([&s, deadline, token](detail::fiber * self) {
+        // nobody else can see the alarm until this worker runs its timers, so there's time to record it
+        s.alarm = worker::current()->schedule_at(deadline, task(self));
+        token->attach(&s);
+      });
+      token->detach(&s);
+    }
+  }
+}
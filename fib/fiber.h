@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+
+#include <boost/context/detail/fcontext.hpp>
+#include <boost/context/stack_context.hpp>
+
+#include "chrono.h"
+#include "task.h"
+
+/// @file fiber.h
+/// @brief @ref fib::detail::fiber and @ref fib::this_fiber
+
+namespace fib {
+  namespace detail {
+    /// @brief A stack that tasks run on, which can be suspended and later resumed on any worker.
+    ///
+    /// The record lives at the top of its own stack. A suspended fiber is a task node, so anything that can
+    /// schedule a task can resume it: queues, mailboxes, inboxes and timers all work unchanged. Fibers belong
+    /// to their pool, which frees every stack when it goes, so destroying the node does nothing.
+    struct fiber final : task_node {
+      boost::context::detail::fcontext_t context; ///< where to jump to resume us. only valid while suspended
+      boost::context::stack_context stack;        ///< the stack we sit atop
+      fiber * prev_fiber;                         ///< links in the pool's list of every fiber it has made
+      fiber * next_fiber;
+
+      explicit fiber(const boost::context::stack_context & stack) noexcept
+        : context(nullptr), stack(stack), prev_fiber(nullptr), next_fiber(nullptr) {}
+
+      /// switch to this fiber, abandoning the one @p w is running to be recycled
+      void run(worker & w) override;
+      void destroy() noexcept override {}
+    };
+  }
+
+  /// operations on the fiber running the current task
+  namespace this_fiber {
+    /// Let everything else queued locally at our priority run first. Outside of a pool, yields the thread.
+    void yield();
+
+    /// Suspend the current task until @p deadline, freeing its worker to run something else in the meantime.
+    /// Outside of a pool, this sleeps the thread.
+    void sleep_until(chrono::clock::time_point deadline);
+
+    /// Suspend the current task for at least @p delay
+    template <typename Rep, typename Period> void sleep_for(const std::chrono::duration<Rep, Period> & delay) {
+      sleep_until(chrono::clock::now() + chrono::ceil<chrono::clock::duration>(delay));
+    }
+  }
+}
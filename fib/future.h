@@ -0,0 +1,602 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "memory/aligned_allocator.h"
+#include "sync.h"
+#include "task.h"
+#include "worker.h"
+
+/// @file future.h
+/// @brief @ref fib::future, @ref fib::promise and their combinators
+
+namespace fib {
+
+  template <typename T> struct future;
+  template <typename T> struct promise;
+
+  /// @brief Reports misuse of a @ref promise or @ref future, and promises broken by being destroyed unsatisfied.
+  ///
+  /// The @p std::future_error constructor taking an error code isn't public until c++17.
+  struct future_error : std::logic_error {
+    explicit future_error(std::future_errc e) : std::logic_error(std::make_error_code(e).message()), ec(std::make_error_code(e)) {}
+    const std::error_code & code() const noexcept { return ec; }
+  private:
+    std::error_code ec;
+  };
+
+  /// How a continuation attached with @ref future::then is run once its future is ready.
+  enum class launch {
+    spawn,    ///< spawned as a task on whichever worker completes the future, at the priority @ref future::then was called at
+    immediate ///< run right there in the completing task. best for short continuations
+  };
+
+  namespace detail {
+    /// @brief something to do once a shared state becomes ready
+    struct continuation : task_node {
+      bool deferred = false; ///< spawn rather than run inline
+      pool * home = nullptr; ///< where to spawn if completed from outside of any worker
+
+      /// do it
+      virtual void call() noexcept = 0;
+
+      /// do it right here, and clean up
+      virtual void fire() noexcept {
+        call();
+        destroy();
+      }
+
+      void run(worker &) override { call(); }
+
+      /// called by whoever completes the state, once
+      void trigger() noexcept {
+        if (deferred) {
+          if (worker * w = worker::current()) {
+            w->schedule(task(this));
+            return;
+          }
+          if (home) {
+            home->post(task(this));
+            return;
+          }
+        }
+        fire();
+      }
+
+    protected:
+      continuation() noexcept {}
+    };
+
+    /// Owned by the state it waits on, which may outlive any pool, so allocated from the aligned heap.
+    template <typename F> struct continuation_impl final : continuation {
+      F f;
+
+      template <typename G> explicit continuation_impl(G && g) : f(std::forward<G>(g)) {}
+
+      void call() noexcept override { f(); }
+
+      void destroy() noexcept override {
+        this->~continuation_impl();
+        memory::detail::deallocate_aligned_memory(this);
+      }
+
+      template <typename G> static continuation * make(G && g) {
+        void * p = memory::detail::allocate_aligned_memory(alignof(continuation_impl), sizeof(continuation_impl));
+        try {
+          return new (p) continuation_impl(std::forward<G>(g));
+        } catch (...) {
+          memory::detail::deallocate_aligned_memory(p);
+          throw;
+        }
+      }
+    };
+
+    /// @brief wakes somebody blocked in @ref future::wait. lives on their stack
+    ///
+    /// Never deferred: @ref waiter::wake already knows where the fiber belongs, whichever pool completes the state.
+    struct wake_continuation final : continuation {
+      explicit wake_continuation(waiter & w) noexcept : w(w) {}
+      void call() noexcept override { w.wake(); }
+      // the waiter, and we along with it, may be gone as soon as it is woken, so don't touch anything afterwards
+      void fire() noexcept override { w.wake(); }
+      void destroy() noexcept override {}
+      waiter & w;
+    };
+
+    /// @brief The part of a shared state that doesn't depend on the value type.
+    ///
+    /// Lock free: @ref waiting holds nothing, a single continuation, or a marker meaning the state is ready.
+    struct state_base {
+      std::atomic<task_node*> waiting;
+      std::atomic<int> refs;
+      std::atomic<bool> satisfied; ///< has a producer claimed the right to complete us?
+      std::exception_ptr error;
+
+      state_base() noexcept {
+        waiting.store(nullptr, std::memory_order_relaxed);
+        refs.store(1, std::memory_order_relaxed);
+        satisfied.store(false, std::memory_order_relaxed);
+      }
+
+      /// claim the right to complete us. false if somebody already has
+      bool claim() noexcept {
+        return !satisfied.exchange(true, std::memory_order_acq_rel);
+      }
+
+      /// stands in for a continuation once the state is ready
+      static task_node * ready_marker() noexcept {
+        static char marker;
+        return reinterpret_cast<task_node*>(&marker);
+      }
+
+      bool ready() const noexcept {
+        return waiting.load(std::memory_order_acquire) == ready_marker();
+      }
+
+      /// Arrange for @p c to be triggered on completion. False, leaving @p c alone, if we're already complete.
+      bool attach(continuation * c) noexcept {
+        task_node * expected = nullptr;
+        return waiting.compare_exchange_strong(expected, c, std::memory_order_acq_rel, std::memory_order_acquire);
+      }
+
+      /// Take back @p c, attached earlier. False if we are completing, and have taken it already.
+      bool detach(continuation * c) noexcept {
+        task_node * expected = c;
+        return waiting.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel, std::memory_order_acquire);
+      }
+
+      /// publish the result, and trigger whoever was waiting for it
+      void complete() noexcept {
+        task_node * c = waiting.exchange(ready_marker(), std::memory_order_acq_rel);
+        if (c) static_cast<continuation*>(c)->trigger();
+      }
+
+      /// block the current fiber or thread until we're ready
+      void wait() noexcept {
+        if (ready()) return;
+        waiter w;
+        wake_continuation c(w);
+        if (worker * current = worker::current()) {
+          w.home = &current->p;
+          worker::suspend([this, &w, &c](detail::fiber * self) {
+            w.fiber = self;
+            // attaching publishes us. if we lost the race with completion, just carry on
+            if (!attach(&c)) worker::current()->schedule(task(self));
+          });
+        } else {
+          blocked_thread t;
+          w.thread = &t;
+          if (!attach(&c)) return;
+          std::unique_lock<std::mutex> g(t.m);
+          t.cv.wait(g, [&t] { return t.done; });
+        }
+      }
+    };
+
+    /// where the value goes
+    template <typename T> struct state_storage {
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+      T & value() noexcept { return *reinterpret_cast<T*>(&storage); }
+      template <typename ... Args> void emplace(Args && ... args) { new (&storage) T(std::forward<Args>(args)...); }
+      void destroy_value() noexcept { value().~T(); }
+    };
+
+    template <> struct state_storage<void> {
+      void emplace() noexcept {}
+      void destroy_value() noexcept {}
+    };
+
+    /// @brief What a @ref promise and its @ref future share.
+    ///
+    /// Allocated from the aligned heap rather than a worker's arena, as either end may outlive the pool.
+    template <typename T> struct shared_state final : state_base, state_storage<T> {
+      static shared_state * make() {
+        return new (memory::detail::allocate_aligned_memory(alignof(shared_state), sizeof(shared_state))) shared_state;
+      }
+
+      void retain() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+
+      void release() noexcept {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        if (ready() && !error) this->destroy_value();
+        this->~shared_state();
+        memory::detail::deallocate_aligned_memory(this);
+      }
+    };
+
+    /// @brief what the alarm of a timed wait on @p s runs
+    ///
+    /// Whoever takes the continuation back off the state wakes the waiter: this, or whoever completes it. We hold a
+    /// reference, as we may only run once the waiter has been woken the other way and let go of the state.
+    template <typename T> struct wait_expiry {
+      shared_state<T> * s;
+      continuation * c;
+      waiter * w;
+
+      wait_expiry(shared_state<T> * s, continuation * c, waiter * w) noexcept : s(s), c(c), w(w) { s->retain(); }
+      wait_expiry(wait_expiry && that) noexcept : s(that.s), c(that.c), w(that.w) { that.s = nullptr; }
+      ~wait_expiry() { if (s) s->release(); }
+
+      void operator ()(worker &) noexcept {
+        if (!s->detach(c)) return;
+        w->timed_out = true;
+        w->wake();
+      }
+    };
+
+    /// block the current fiber or thread until @p s is ready or @p deadline passes. true if it is ready
+    template <typename T> bool wait_until(shared_state<T> & s, chrono::clock::time_point deadline) {
+      if (s.ready()) return true;
+      waiter w;
+      wake_continuation c(w);
+      if (worker * current = worker::current()) {
+        w.home = &current->p;
+        worker::suspend([&s, &w, &c, deadline](detail::fiber * self) {
+          w.fiber = self;
+          // set the alarm before attaching publishes us, after which we may be resumed anywhere at any moment
+          worker & v = *worker::current();
+          w.alarm = v.schedule_at(deadline, task(v.arena, wait_expiry<T>(&s, &c, &w)));
+          if (!s.attach(&c)) {
+            w.alarm.cancel();
+            v.schedule(task(self));
+          }
+        });
+        w.alarm.cancel(); // if we were completed, the alarm needn't wait around holding the state
+        return !w.timed_out;
+      }
+      blocked_thread t;
+      w.thread = &t;
+      if (!s.attach(&c)) return true;
+      std::unique_lock<std::mutex> g(t.m);
+      if (t.cv.wait_until(g, chrono::clock::to_steady(deadline), [&t] { return t.done; })) return true;
+      if (s.detach(&c)) return false;
+      // completing, and about to wake us
+      t.cv.wait(g, [&t] { return t.done; });
+      return true;
+    }
+
+    /// call @p f, and fulfil @p p with the outcome
+    template <typename R> struct fulfil {
+      template <typename F, typename ... Args> static void call(promise<R> & p, F & f, Args && ... args) noexcept {
+        try {
+          p.set_value(f(std::forward<Args>(args)...));
+        } catch (...) {
+          p.set_exception(std::current_exception());
+        }
+      }
+    };
+
+    template <> struct fulfil<void> {
+      template <typename P, typename F, typename ... Args> static void call(P & p, F & f, Args && ... args) noexcept {
+        try {
+          f(std::forward<Args>(args)...);
+          p.set_value();
+        } catch (...) {
+          p.set_exception(std::current_exception());
+        }
+      }
+    };
+
+    /// what @ref future::then leaves waiting on a state
+    template <typename T, typename R, typename F> struct then_call {
+      future<T> source;
+      promise<R> target;
+      F f;
+      void operator ()() noexcept { fulfil<R>::call(target, f, std::move(source)); }
+    };
+
+    /// what @ref async spawns
+    template <typename R, typename F> struct async_call {
+      promise<R> target;
+      F f;
+      void operator ()(worker & w) noexcept { fulfil<R>::call(target, f, w); }
+    };
+
+    /// @brief what calling an lvalue @p F with @p Args gives.
+    ///
+    /// @p std::result_of is deprecated in c++17 and gone in c++20, and @p std::invoke_result isn't in c++11.
+    template <typename F, typename ... Args> struct call_result {
+      typedef decltype(std::declval<F &>()(std::declval<Args>()...)) type;
+    };
+
+    /// fill in the continuation's scheduling details from the calling worker, if any
+    inline void place(continuation * c, launch how) noexcept {
+      c->deferred = how == launch::spawn;
+      if (worker * w = worker::current()) {
+        c->home = &w->p;
+        c->level = w->level;
+      }
+    }
+  }
+
+  /// @brief The producing end of a @ref future.
+  ///
+  /// Allocation light: the state shared with the future is one allocation, and completing it is a
+  /// single atomic exchange. There is no mutex anywhere. Destroying an unsatisfied promise leaves a
+  /// @ref future_error with @p std::future_errc::broken_promise for the future.
+  ///
+  /// Promises, futures and their continuations come from the aligned heap rather than a worker's arena, so
+  /// either end may outlive the pool it was made in. A continuation launched with @ref launch::spawn still needs
+  /// a live pool to run on when the future completes.
+  template <typename T> struct promise {
+    promise() : state(detail::shared_state<T>::make()), retrieved(false) {}
+    promise(promise && that) noexcept : state(that.state), retrieved(that.retrieved) { that.state = nullptr; }
+    promise & operator = (promise && that) noexcept {
+      std::swap(state, that.state);
+      std::swap(retrieved, that.retrieved);
+      return *this;
+    }
+
+    ~promise() {
+      if (state == nullptr) return;
+      if (state->claim()) {
+        state->error = std::make_exception_ptr(future_error(std::future_errc::broken_promise));
+        state->complete();
+      }
+      state->release();
+    }
+
+    /// @cond PRIVATE
+    promise(const promise &) = delete;
+    promise & operator = (const promise &) = delete;
+    /// @endcond
+
+    /// The future for our result. At most once.
+    future<T> get_future() {
+      if (state == nullptr) throw future_error(std::future_errc::no_state);
+      if (retrieved) throw future_error(std::future_errc::future_already_retrieved);
+      retrieved = true;
+      state->retain();
+      return future<T>(state);
+    }
+
+    /// @brief Construct the result from @p args and make it ready, triggering any continuation.
+    ///
+    /// Throws @ref future_error with @p std::future_errc::promise_already_satisfied if the result was already set.
+    /// If constructing the result throws, the promise is left unsatisfied.
+    template <typename ... Args> void set_value(Args && ... args) {
+      satisfy();
+      try {
+        state->emplace(std::forward<Args>(args)...);
+      } catch (...) {
+        state->satisfied.store(false, std::memory_order_release);
+        throw;
+      }
+      state->complete();
+    }
+
+    /// Make the result ready with @p e. Throws as @ref set_value does if the result was already set.
+    void set_exception(std::exception_ptr e) {
+      satisfy();
+      state->error = e;
+      state->complete();
+    }
+
+  private:
+    detail::shared_state<T> * state;
+    bool retrieved;
+
+    /// claim the state for completion, or throw
+    void satisfy() {
+      if (state == nullptr) throw future_error(std::future_errc::no_state);
+      if (!state->claim()) throw future_error(std::future_errc::promise_already_satisfied);
+    }
+  };
+
+  /// @brief A result that may not be ready yet.
+  ///
+  /// Waiting suspends the current fiber rather than blocking its worker. Outside of a pool it blocks the thread.
+  /// Timed waits on a fiber are kept by its worker's timing wheel.
+  /// A future has a single consumer: @ref get, @ref then and the combinators all take it over.
+  template <typename T> struct future {
+    future() noexcept : state(nullptr) {}
+    future(future && that) noexcept : state(that.state) { that.state = nullptr; }
+    future & operator = (future && that) noexcept {
+      std::swap(state, that.state);
+      return *this;
+    }
+    ~future() { if (state) state->release(); }
+
+    /// @cond PRIVATE
+    future(const future &) = delete;
+    future & operator = (const future &) = delete;
+    explicit future(detail::shared_state<T> * state) noexcept : state(state) {}
+    /// @endcond
+
+    bool valid() const noexcept { return state != nullptr; }
+
+    /// Is the result ready? Throws @ref future_error with @p std::future_errc::no_state if we aren't @ref valid, as do the rest.
+    bool is_ready() const {
+      check();
+      return state->ready();
+    }
+
+    /// Wait for the result to be ready.
+    void wait() const {
+      check();
+      state->wait();
+    }
+
+    /// Wait for the result to be ready until @p deadline at most.
+    std::future_status wait_until(chrono::clock::time_point deadline) const {
+      check();
+      return detail::wait_until(*state, deadline) ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    /// Wait for the result to be ready for @p delay at most.
+    template <typename Rep, typename Period> std::future_status wait_for(const std::chrono::duration<Rep, Period> & delay) const {
+      return wait_until(detail::after(delay));
+    }
+
+    /// Wait for the result, and take it, or rethrow whatever the producer failed with.
+    T get() {
+      check();
+      detail::shared_state<T> * s = state;
+      state = nullptr;
+      std::unique_ptr<detail::shared_state<T>, release_state> hold(s);
+      s->wait();
+      if (s->error) std::rethrow_exception(s->error);
+      return take(*s);
+    }
+
+    /// @brief Call @p f with this future once it is ready, and get a future for what @p f returns.
+    ///
+    /// The continuation is held by the shared state, on the aligned heap.
+    template <typename F> future<typename detail::call_result<typename std::decay<F>::type, future<T>>::type> then(F && f, launch how = launch::spawn) {
+      typedef typename detail::call_result<typename std::decay<F>::type, future<T>>::type R;
+      typedef detail::then_call<T, R, typename std::decay<F>::type> call;
+      check();
+      promise<R> p;
+      future<R> result = p.get_future();
+      detail::shared_state<T> * s = state;
+      detail::continuation * c = detail::continuation_impl<call>::make(call { std::move(*this), std::move(p), std::forward<F>(f) });
+      detail::place(c, how);
+      if (!s->attach(c)) c->trigger();
+      return result;
+    }
+
+  private:
+    struct release_state {
+      void operator ()(detail::shared_state<T> * s) const noexcept { s->release(); }
+    };
+
+    void check() const {
+      if (state == nullptr) throw future_error(std::future_errc::no_state);
+    }
+
+    template <typename U> static U take(detail::shared_state<U> & s) { return std::move(s.value()); }
+    static void take(detail::shared_state<void> &) noexcept {}
+
+    detail::shared_state<T> * state;
+  };
+
+  /// a future that is already ready with @p value
+  template <typename T> future<typename std::decay<T>::type> make_ready_future(T && value) {
+    promise<typename std::decay<T>::type> p;
+    p.set_value(std::forward<T>(value));
+    return p.get_future();
+  }
+
+  inline future<void> make_ready_future() {
+    promise<void> p;
+    p.set_value();
+    return p.get_future();
+  }
+
+  /// Spawn @p f on @p w, as with @ref worker::spawn, and get a future for what it returns.
+  template <typename F> future<typename detail::call_result<typename std::decay<F>::type, worker &>::type> async(worker & w, F && f) {
+    typedef typename detail::call_result<typename std::decay<F>::type, worker &>::type R;
+    promise<R> p;
+    future<R> result = p.get_future();
+    w.spawn(detail::async_call<R, typename std::decay<F>::type> { std::move(p), std::forward<F>(f) });
+    return result;
+  }
+
+  /// Submit @p f to @p p, as with @ref pool::submit, and get a future for what it returns. Safe to call from any thread.
+  template <typename F> future<typename detail::call_result<typename std::decay<F>::type, worker &>::type> async(pool & p, F && f, fib::priority level = priority::normal) {
+    typedef typename detail::call_result<typename std::decay<F>::type, worker &>::type R;
+    promise<R> pr;
+    future<R> result = pr.get_future();
+    p.submit(detail::async_call<R, typename std::decay<F>::type> { std::move(pr), std::forward<F>(f) }, level);
+    return result;
+  }
+
+  /// @cond PRIVATE
+  namespace detail {
+    template <typename T> struct when_all_state {
+      std::vector<future<T>> results;
+      std::atomic<std::size_t> remaining;
+      promise<std::vector<future<T>>> done;
+    };
+
+    template <typename ... Ts> struct when_all_tuple_state {
+      std::tuple<future<Ts>...> results;
+      std::atomic<std::size_t> remaining;
+      promise<std::tuple<future<Ts>...>> done;
+    };
+
+    template <std::size_t I, typename S> void when_all_attach(const std::shared_ptr<S> &) {}
+
+    template <std::size_t I, typename S, typename T, typename ... Ts> void when_all_attach(const std::shared_ptr<S> & s, future<T> && f, Ts && ... fs) {
+      f.then([s](future<T> r) {
+        std::get<I>(s->results) = std::move(r);
+        if (s->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) s->done.set_value(std::move(s->results));
+      }, launch::immediate);
+      when_all_attach<I + 1>(s, std::forward<Ts>(fs)...);
+    }
+
+    template <typename T> struct when_any_state {
+      std::atomic<bool> decided;
+      promise<std::pair<std::size_t, future<T>>> done;
+    };
+  }
+  /// @endcond
+
+  /// @brief A future for all of the futures in [@p first, @p last), once every one of them is ready.
+  ///
+  /// Each input gets an inline continuation that counts down a shared counter, so there is no waiting task.
+  template <typename It> future<std::vector<typename std::iterator_traits<It>::value_type>> when_all(It first, It last) {
+    typedef typename std::iterator_traits<It>::value_type F;
+    typedef detail::when_all_state<decltype(std::declval<F>().get())> S;
+    std::shared_ptr<S> s = std::make_shared<S>();
+    std::size_t n = std::size_t(std::distance(first, last));
+    future<std::vector<F>> result = s->done.get_future();
+    if (n == 0) {
+      s->done.set_value(std::vector<F>());
+      return result;
+    }
+    s->results.resize(n);
+    s->remaining.store(n, std::memory_order_relaxed);
+    for (std::size_t i = 0; first != last; ++first, ++i)
+      first->then([s, i](F r) {
+        s->results[i] = std::move(r);
+        if (s->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) s->done.set_value(std::move(s->results));
+      }, launch::immediate);
+    return result;
+  }
+
+  /// A future for a tuple of all of @p fs, once every one of them is ready.
+  template <typename ... Ts> future<std::tuple<future<Ts>...>> when_all(future<Ts> && ... fs) {
+    typedef detail::when_all_tuple_state<Ts...> S;
+    std::shared_ptr<S> s = std::make_shared<S>();
+    future<std::tuple<future<Ts>...>> result = s->done.get_future();
+    s->remaining.store(sizeof...(Ts), std::memory_order_relaxed);
+    if (sizeof...(Ts) == 0) s->done.set_value(std::move(s->results));
+    else detail::when_all_attach<0>(s, std::move(fs)...);
+    return result;
+  }
+
+  /// @brief A future for the first of the futures in [@p first, @p last) to be ready, along with its position.
+  ///
+  /// The others are left to finish on their own, and their results are discarded. Fails with a
+  /// @ref future_error if the range is empty.
+  template <typename It> future<std::pair<std::size_t, typename std::iterator_traits<It>::value_type>> when_any(It first, It last) {
+    typedef typename std::iterator_traits<It>::value_type F;
+    typedef detail::when_any_state<decltype(std::declval<F>().get())> S;
+    std::shared_ptr<S> s = std::make_shared<S>();
+    s->decided.store(false, std::memory_order_relaxed);
+    future<std::pair<std::size_t, F>> result = s->done.get_future();
+    if (first == last) {
+      s->done.set_exception(std::make_exception_ptr(future_error(std::future_errc::no_state)));
+      return result;
+    }
+    for (std::size_t i = 0; first != last; ++first, ++i)
+      first->then([s, i](F r) {
+        if (!s->decided.exchange(true, std::memory_order_acq_rel)) s->done.set_value(i, std::move(r));
+      }, launch::immediate);
+    return result;
+  }
+}
@@ -1,8 +1,14 @@
-#include <boost/context/all.hpp>
+#pragma once
+
+#include <boost/context/detail/fcontext.hpp>
+#include <boost/context/protected_fixedsize_stack.hpp>
+#include <cassert>
 #include <exception>
 #include <memory>
 #include <type_traits>
 
+#include "trace.h"
+
 // c# style enumerators, made w/ expression templates to minimize fiber overhead.
 
 namespace fib {
@@ -29,6 +35,11 @@ namespace fib {
   };
 
   namespace detail {
+    // combinators copy the expression they extend, unless it can only be walked once, like a coroutine generator
+    template <typename T> typename std::conditional<std::is_copy_constructible<T>::value, const T &, T &&>::type hand_over(T & t) {
+      return static_cast<typename std::conditional<std::is_copy_constructible<T>::value, const T &, T &&>::type>(t);
+    }
+
     template <typename T, typename F, typename A, typename B> struct then_enumerator : enumerator_expr<then_enumerator<T,F,A,B>,B> {
       T m;
       F f;
@@ -36,6 +47,7 @@ namespace fib {
       then_enumerator(const then_enumerator &) = default;
       then_enumerator(then_enumerator &&) = default;
       then_enumerator(const T & m, const F & f) : m(m), f(f) {}
+      then_enumerator(T && m, const F & f) : m(std::move(m)), f(f) {}
       template <typename G> void foreach(G g) {
         m.foreach([&](A a){ f(a).foreach(g); });
       }
@@ -48,6 +60,7 @@ namespace fib {
       where_enumerator(const where_enumerator &) = default;
       where_enumerator(where_enumerator &&) = default;
       where_enumerator(const T & m, const P & p) : m(m), p(p) {}
+      where_enumerator(T && m, const P & p) : m(std::move(m)), p(p) {}
       template <typename G> void foreach(G g) { 
         m.foreach([&](A a) { if (p(a)) g(a); });
       }
@@ -60,6 +73,7 @@ namespace fib {
       map_enumerator(const map_enumerator &) = default;
       map_enumerator(map_enumerator &&) = default;
       map_enumerator(const T & m, const F & f) : m(m), f(f) {}
+      map_enumerator(T && m, const F & f) : m(std::move(m)), f(f) {}
       template <typename G> void foreach(G g) { 
         m.foreach([&](A a) { g(f(a)); });
       }
@@ -67,13 +81,13 @@ namespace fib {
   }
 
   template <typename T, typename A> template <typename P> detail::where_enumerator<T,P,A> enumerator_expr<T,A>::where(P p) { 
-    return detail::where_enumerator<T,P,A>(*this,p);
+    return detail::where_enumerator<T,P,A>(detail::hand_over(static_cast<T&>(*this)),p);
   }
   template <typename T, typename A> template <typename F> auto enumerator_expr<T,A>::then(F f) -> detail::then_enumerator<T,F,A,decltype(f(std::declval<A>()))> {
-    return detail::then_enumerator<T,F,A,decltype(f(A()))>(*this,f);
+    return detail::then_enumerator<T,F,A,decltype(f(A()))>(detail::hand_over(static_cast<T&>(*this)),f);
   }
   template <typename T, typename A> template <typename F> auto enumerator_expr<T,A>::map(F f) -> detail::map_enumerator<T,F,A,decltype(f(std::declval<A>()))> {
-    return detail::map_enumerator<T,F,A,decltype(f(A()))>(*this,f);
+    return detail::map_enumerator<T,F,A,decltype(f(A()))>(detail::hand_over(static_cast<T&>(*this)),f);
   }
 
   // -------------------------------------------------------------------------------- 
@@ -131,20 +145,20 @@ namespace fib {
   }
 
   // -------------------------------------------------------------------------------- 
-  // Tasks
+  // One-shot functions
   // -------------------------------------------------------------------------------- 
 
   namespace detail {
-    template <typename R, typename ... Args> struct task_base { 
-      // task_base() = delete;
-      // task_base(const task_base & other) = delete;
+    template <typename R, typename ... Args> struct function_base { 
+      // function_base() = delete;
+      // function_base(const function_base & other) = delete;
       virtual R operator ()(Args...) = 0;
-      virtual ~task_base() {}
+      virtual ~function_base() {}
     };
 
-    template <typename F, typename R, typename ... Args> struct task_impl : task_base<R,Args...> {
+    template <typename F, typename R, typename ... Args> struct function_impl : function_base<R,Args...> {
       F f;
-      task_impl(F f) : f(f) {}
+      function_impl(F f) : f(f) {}
       virtual R operator ()(Args... args) {
         return f(args...);
       }
@@ -152,32 +166,33 @@ namespace fib {
   }
 
   // one-shot std::function, only requires move construction
-  template <typename> struct task;
-  template <typename R, typename ... Args> struct task<R(Args...)> {
-    template <typename F> task(F f) : task(f,typename std::integral_constant<bool, std::is_convertible<F,bool>::value>::type()) {}
-    task() : impl () {}
-    task(std::nullptr_t) : impl() {}
-    task(const task & t) = delete;
+  template <typename> struct unique_function;
+  template <typename R, typename ... Args> struct unique_function<R(Args...)> {
+    template <typename F> unique_function(F f) : unique_function(f,typename std::integral_constant<bool, std::is_convertible<F,bool>::value>::type()) {}
+    unique_function() : impl () {}
+    unique_function(std::nullptr_t) : impl() {}
+    unique_function(const unique_function & t) = delete;
+    unique_function(unique_function && t) = default;
     R operator ()(Args... args) { return (*impl)(args...); }
     operator bool () const { return impl; }
     typedef R result_type;
-    void swap(task & other) {
+    void swap(unique_function & other) {
       std::swap(impl,other.impl);
     }
-    task & operator = (task && rhs) {
+    unique_function & operator = (unique_function && rhs) {
       impl = std::move(rhs.impl);
       return *this;
     }
-    std::unique_ptr<detail::task_base<R,Args...>> impl;
+    std::unique_ptr<detail::function_base<R,Args...>> impl;
   private:
-    template <typename F> task(F f, std::false_type) : impl(new detail::task_impl<F,R,Args...>(f)) {}         // not bool convertible
-    template <typename F> task(F f, std::true_type) : impl(f?new detail::task_impl<F,R,Args...>(f):nullptr) {} // bool convertible, check if null
+    template <typename F> unique_function(F f, std::false_type) : impl(new detail::function_impl<F,R,Args...>(f)) {}         // not bool convertible
+    template <typename F> unique_function(F f, std::true_type) : impl(f?new detail::function_impl<F,R,Args...>(f):nullptr) {} // bool convertible, check if null
   };
 
-  template <typename R, typename ... Args> bool operator == (const task<R(Args...)> & t, std::nullptr_t) { return !t; }
-  template <typename R, typename ... Args> bool operator == (std::nullptr_t, const task<R(Args...)> & t) { return !t; }
-  template <typename R, typename ... Args> bool operator != (const task<R(Args...)> & t, std::nullptr_t) { return bool(t); }
-  template <typename R, typename ... Args> bool operator != (std::nullptr_t, const task<R(Args...)> & t) { return bool(t); }
+  template <typename R, typename ... Args> bool operator == (const unique_function<R(Args...)> & t, std::nullptr_t) { return !t; }
+  template <typename R, typename ... Args> bool operator == (std::nullptr_t, const unique_function<R(Args...)> & t) { return !t; }
+  template <typename R, typename ... Args> bool operator != (const unique_function<R(Args...)> & t, std::nullptr_t) { return bool(t); }
+  template <typename R, typename ... Args> bool operator != (std::nullptr_t, const unique_function<R(Args...)> & t) { return bool(t); }
 
   // -------------------------------------------------------------------------------- 
   // enumerators
@@ -249,7 +264,9 @@ namespace fib {
         ~cleanup() { allocator.deallocate(sp); }
       } finally { allocator,sp };
       sp.sp = nullptr;
+      trace::begin(trace::what::enumerator);
       boost::context::detail::transfer_t t = boost::context::detail::jump_fcontext(g,reinterpret_cast<void*>(&body));
+      trace::end(trace::what::enumerator);
       int i = static_cast<status>(reinterpret_cast<intptr_t>(t.data));
       while (i == status::next) {
         try { 
@@ -258,7 +275,9 @@ namespace fib {
           last.a.~A();
           throw;
         }
+        trace::begin(trace::what::enumerator);
         t = boost::context::detail::jump_fcontext(t.fctx,reinterpret_cast<void*>(&body));
+        trace::end(trace::what::enumerator);
         i = static_cast<status>(reinterpret_cast<intptr_t>(t.data));
       }
       g = t.fctx;
@@ -284,9 +303,9 @@ namespace fib {
     stack_allocator allocator;
     boost::context::stack_context sp;
     boost::context::detail::fcontext_t g;
-    task<void(boost::context::detail::fcontext_t)> body; // for a move only function, this is more than we need, fix that.
+    unique_function<void(boost::context::detail::fcontext_t)> body; // for a move only function, this is more than we need, fix that.
     static void exec(boost::context::detail::transfer_t p) { 
-      (*reinterpret_cast<task<void(boost::context::detail::fcontext_t)>*>(p.data))(p.fctx);
+      (*reinterpret_cast<unique_function<void(boost::context::detail::fcontext_t)>*>(p.data))(p.fctx);
     }
   };
 }
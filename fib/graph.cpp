@@ -0,0 +1,125 @@
+#include <stdexcept>
+
+#include "graph.h"
+#include "worker.h"
+
+/// @file graph.cpp
+/// @brief running a @ref fib::graph
+
+namespace fib {
+  namespace detail {
+    void graph_node::finished() noexcept {
+      // we may have suspended, and come back on another worker
+      worker * w = worker::current();
+      for (graph_node * s : successors)
+        if (s->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          w->schedule(task(s));
+    }
+
+    void graph_node::destroy() noexcept {
+      // a successor queued above may finish first, but can't complete the run while we still count
+      graph * g = owner;
+      std::size_t gone = 1;
+      if (!ran) {
+        // dropped unrun. successors we were the last predecessor of will never be queued, so count them out too,
+        // stacking them on their unused queue links rather than recursing down a long chain
+        graph_node * dropped = nullptr;
+        for (graph_node * s : successors)
+          if (s->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            s->next = dropped;
+            dropped = s;
+          }
+        while (dropped != nullptr) {
+          graph_node * n = dropped;
+          dropped = static_cast<graph_node *>(n->next);
+          n->next = nullptr;
+          ++gone;
+          for (graph_node * s : n->successors)
+            if (s->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+              s->next = dropped;
+              dropped = s;
+            }
+        }
+      }
+      if (g->remaining.fetch_sub(gone, std::memory_order_acq_rel) == gone) g->finish(); // we may be freed from here on
+    }
+  }
+
+  void graph::precede(node before, node after) {
+    if (before >= nodes.size() || after >= nodes.size()) throw std::out_of_range("fib::graph::precede");
+    nodes[before]->successors.push_back(nodes[after].get());
+    ++nodes[after]->predecessors;
+    checked = false;
+  }
+
+  void graph::check() {
+    roots.clear();
+    for (auto & n : nodes)
+      if (n->predecessors == 0) roots.push_back(n.get());
+    // Kahn's algorithm, using pending as scratch: every node must come free
+    for (auto & n : nodes) n->pending.store(n->predecessors, std::memory_order_relaxed);
+    std::vector<detail::graph_node *> ready(roots);
+    std::size_t seen = 0;
+    while (!ready.empty()) {
+      detail::graph_node * n = ready.back();
+      ready.pop_back();
+      ++seen;
+      for (detail::graph_node * s : n->successors)
+        if (s->pending.fetch_sub(1, std::memory_order_relaxed) == 1) ready.push_back(s);
+    }
+    if (seen != nodes.size()) throw std::logic_error("fib::graph: cycle");
+    checked = true;
+  }
+
+  void graph::start(pool & p) {
+    guard.lock();
+    bool busy = running;
+    running = !nodes.empty();
+    guard.unlock();
+    if (busy) throw std::logic_error("fib::graph: already running");
+    if (nodes.empty()) return;
+    try {
+      if (!checked) check();
+    } catch (...) {
+      finish();
+      throw;
+    }
+    for (auto & n : nodes) {
+      n->pending.store(n->predecessors, std::memory_order_relaxed);
+      n->ran = false;
+    }
+    remaining.store(nodes.size(), std::memory_order_relaxed);
+    // publishing a root releases everything above. queue them so the first added runs first
+    worker * w = worker::current();
+    if (w != nullptr && &w->p == &p) {
+      for (auto i = roots.rbegin(); i != roots.rend(); ++i) w->schedule(task(*i));
+    } else {
+      for (detail::graph_node * r : roots) p.post(task(r));
+    }
+  }
+
+  void graph::wait() {
+    guard.lock();
+    if (!running) {
+      guard.unlock();
+      return;
+    }
+    detail::waiter w;
+    detail::block(w, waiters, guard);
+  }
+
+  bool graph::done() const noexcept {
+    guard.lock();
+    bool result = !running;
+    guard.unlock();
+    return result;
+  }
+
+  void graph::finish() noexcept {
+    guard.lock();
+    running = false;
+    detail::waiter * w = waiters.pop_all();
+    guard.unlock();
+    detail::wake_all(w);
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sync.h"
+#include "task.h"
+
+/// @file graph.h
+/// @brief @ref fib::graph, a reusable DAG of tasks
+
+namespace fib {
+
+  struct graph;
+  struct pool;
+
+  namespace detail {
+    /// @brief a node of a @ref graph. owned by the graph, and queued by pointer, so running it allocates nothing
+    struct graph_node : task_node {
+      graph * owner;
+      std::vector<graph_node *> successors;
+      std::size_t predecessors;         ///< how many edges lead here
+      std::atomic<std::size_t> pending; ///< predecessors yet to finish in this run
+      bool ran;                         ///< have we run in this run, rather than being dropped?
+
+      explicit graph_node(graph * owner) noexcept : owner(owner), predecessors(0), ran(false) {
+        pending.store(0, std::memory_order_relaxed);
+      }
+      virtual ~graph_node() {}
+
+      /// queue every successor we were the last predecessor of on the current worker
+      void finished() noexcept;
+
+      /// @brief Nothing to free, but count ourselves finished.
+      ///
+      /// The worker calls this once it is done with us, so only here may we let go of the graph: the last node out
+      /// reports the run complete, and the waiter may free everything straight away. Nodes dropped unrun, as when
+      /// their pool shuts down, count as finished too, along with every successor that would only have been
+      /// released by them, so waiters are never stranded.
+      void destroy() noexcept override;
+    };
+
+    template <typename F> struct graph_node_impl final : graph_node {
+      F f;
+
+      template <typename G> graph_node_impl(graph * owner, G && g) : graph_node(owner), f(std::forward<G>(g)) {}
+
+      void run(worker & w) override {
+        ran = true;
+        f(w);
+        finished();
+      }
+    };
+  }
+
+  /// @brief A directed acyclic graph of tasks, built once and run as many times as you like.
+  ///
+  /// Each node keeps an atomic count of the predecessors it is still waiting on. A node becomes ready the moment its
+  /// last predecessor finishes, and is queued on the worker that finished it, where its inputs are still in cache.
+  /// Idle workers get their share the usual way, by being dealt work, so there is no barrier between waves.
+  ///
+  /// Nodes are allocated as they are added. Running a built graph allocates nothing: the nodes themselves are what
+  /// gets queued.
+  ///
+  /// Nodes run outside of any cancellation token, so that a run always completes. A graph may only have one run in
+  /// flight at a time, and must not be changed or destroyed while it does.
+  struct graph {
+    /// identifies a node of a graph
+    typedef std::size_t node;
+
+    graph() noexcept : running(false), checked(true) {
+      remaining.store(0, std::memory_order_relaxed);
+    }
+
+    /// @cond PRIVATE
+    graph(const graph &) = delete;
+    graph & operator = (const graph &) = delete;
+    /// @endcond
+
+    /// Add a node calling @p f with the worker running it, at priority @p level.
+    template <typename F> node emplace(F && f, fib::priority level = priority::normal) {
+      std::unique_ptr<detail::graph_node> n(new detail::graph_node_impl<typename std::decay<F>::type>(this, std::forward<F>(f)));
+      n->level = level;
+      nodes.push_back(std::move(n));
+      checked = false;
+      return nodes.size() - 1;
+    }
+
+    /// @p before must finish before @p after starts
+    void precede(node before, node after);
+
+    /// how many nodes we have
+    std::size_t size() const noexcept { return nodes.size(); }
+
+    /// @brief Start a run on @p p, and return without waiting for it.
+    ///
+    /// Nodes without predecessors go on the current worker's queue if we are running on one of @p p's workers,
+    /// and to @p p's inboxes otherwise. Throws @p std::logic_error if a run is already in flight, or if there is a cycle.
+    void start(pool & p);
+
+    /// Wait for the run in flight, if any, to finish. Suspends the current fiber rather than blocking its worker.
+    void wait();
+
+    /// @ref start a run on @p p, and @ref wait for it
+    void run(pool & p) {
+      start(p);
+      wait();
+    }
+
+    /// is there no run in flight?
+    bool done() const noexcept;
+
+  private:
+    friend struct detail::graph_node;
+
+    std::vector<std::unique_ptr<detail::graph_node>> nodes;
+    std::vector<detail::graph_node *> roots; ///< nodes without predecessors, built by @ref check
+    std::atomic<std::size_t> remaining;      ///< nodes yet to finish in this run
+    mutable detail::spinlock guard;          ///< guards @ref running and @ref waiters
+    detail::wait_queue waiters;
+    bool running;
+    bool checked;                            ///< are @ref roots current, and the graph known to be acyclic?
+
+    /// find the roots, and make sure every node is reachable from one
+    void check();
+    /// called by the node that finished the run
+    void finish() noexcept;
+  };
+}
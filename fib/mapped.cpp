@@ -0,0 +1,73 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+#include "mapped.h"
+
+/// @file mapped.cpp
+/// @brief mmap based implementation of @ref fib::mapped_file
+
+namespace fib {
+  /// @cond PRIVATE
+  namespace {
+    int advice(mapped_file::access_pattern how) noexcept {
+      switch (how) {
+        case mapped_file::sequential: return MADV_SEQUENTIAL;
+        case mapped_file::random: return MADV_RANDOM;
+        case mapped_file::willneed: return MADV_WILLNEED;
+        default: return MADV_NORMAL;
+      }
+    }
+  }
+  /// @endcond
+
+  mapped_file::mapped_file(const std::string & path, access_pattern how) : p(nullptr), n(0) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "fib::mapped_file: open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      int e = errno;
+      ::close(fd);
+      throw std::system_error(e, std::generic_category(), "fib::mapped_file: stat " + path);
+    }
+    if (st.st_size > 0) {
+      // the mapping holds its own reference to the file, so we can close it straight away
+      void * m = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m == MAP_FAILED) {
+        int e = errno;
+        ::close(fd);
+        throw std::system_error(e, std::generic_category(), "fib::mapped_file: mmap " + path);
+      }
+      p = static_cast<const char *>(m);
+      n = std::size_t(st.st_size);
+    }
+    ::close(fd);
+    advise(all(), how);
+  }
+
+  mapped_file::~mapped_file() {
+    if (p) ::munmap(const_cast<char *>(p), n);
+  }
+
+  void mapped_file::advise(byte_range r, access_pattern how) const noexcept {
+    if (p == nullptr || r.first >= r.last || r.first >= n) return;
+    // madvise wants a page aligned start
+    static const std::size_t page = std::size_t(::sysconf(_SC_PAGESIZE));
+    std::size_t first = r.first / page * page, last = std::min(r.last, n);
+    ::madvise(const_cast<char *>(p) + first, last - first, advice(how));
+  }
+
+  std::vector<byte_range> mapped_file::split(byte_range r, std::size_t parts) {
+    std::vector<byte_range> result;
+    if (parts == 0) return result;
+    std::size_t size = r.last > r.first ? r.last - r.first : 0;
+    result.reserve(parts);
+    for (std::size_t k = 0; k < parts; ++k)
+      result.push_back(byte_range { r.first + size / parts * k + std::min(k, size % parts), r.first + size / parts * (k + 1) + std::min(k + 1, size % parts) });
+    return result;
+  }
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+#include "generator.hpp"
+
+/// @file mapped.h
+/// @brief @ref fib::mapped_file, and enumerators over the lines and records in one without copying
+
+namespace fib {
+
+  /// @brief A borrowed run of bytes, like @p std::string_view, pointing into wherever it came from.
+  struct slice {
+    slice() noexcept : p(nullptr), n(0) {}
+    slice(const char * p, std::size_t n) noexcept : p(p), n(n) {}
+
+    const char * data() const noexcept { return p; }
+    std::size_t size() const noexcept { return n; }
+    bool empty() const noexcept { return n == 0; }
+    const char * begin() const noexcept { return p; }
+    const char * end() const noexcept { return p + n; }
+    char operator [](std::size_t i) const noexcept { return p[i]; }
+
+    /// copy it out
+    std::string str() const { return std::string(p, n); }
+#if __cplusplus >= 201703L
+    operator std::string_view () const noexcept { return std::string_view(p, n); }
+#endif
+
+    friend bool operator == (const slice & a, const slice & b) noexcept { return a.n == b.n && (a.n == 0 || std::memcmp(a.p, b.p, a.n) == 0); }
+    friend bool operator != (const slice & a, const slice & b) noexcept { return !(a == b); }
+
+  private:
+    const char * p;
+    std::size_t n;
+  };
+
+  /// the bytes [@ref first, @ref last) of a file
+  struct byte_range {
+    std::size_t first, last;
+    std::size_t size() const noexcept { return last - first; }
+  };
+
+  /// @brief A whole file mapped read only into memory.
+  ///
+  /// Slices taken from it borrow the mapping, and are good for as long as it lives. The mapping is advised for
+  /// sequential access when opened, so the kernel reads ahead aggressively and drops pages behind us.
+  struct mapped_file {
+    /// how we intend to read a part of the file
+    enum access_pattern {
+      normal,     ///< no particular order
+      sequential, ///< front to back, once: read ahead and free behind
+      random,     ///< no read ahead
+      willneed    ///< start reading it in now
+    };
+
+    mapped_file() noexcept : p(nullptr), n(0) {}
+
+    /// map the file at @p path. Throws @p std::system_error if it can't be opened or mapped.
+    explicit mapped_file(const std::string & path, access_pattern how = sequential);
+
+    mapped_file(mapped_file && that) noexcept : p(that.p), n(that.n) {
+      that.p = nullptr;
+      that.n = 0;
+    }
+    mapped_file & operator = (mapped_file && that) noexcept {
+      std::swap(p, that.p);
+      std::swap(n, that.n);
+      return *this;
+    }
+    ~mapped_file();
+
+    /// @cond PRIVATE
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator = (const mapped_file &) = delete;
+    /// @endcond
+
+    const char * data() const noexcept { return p; }
+    std::size_t size() const noexcept { return n; }
+    bool is_open() const noexcept { return p != nullptr; }
+
+    /// the whole file
+    byte_range all() const noexcept { return byte_range { 0, n }; }
+
+    /// the bytes of @p r, clamped to the file
+    slice bytes(byte_range r) const noexcept {
+      std::size_t last = std::min(r.last, n), first = std::min(r.first, last);
+      return slice(p + first, last - first);
+    }
+
+    /// Tell the kernel how @p r is about to be read. Only a hint: failures are ignored.
+    void advise(byte_range r, access_pattern how) const noexcept;
+
+    /// @brief Cut @p r into @p parts contiguous ranges of about the same size, to hand one to each worker.
+    ///
+    /// The cuts fall anywhere. @ref lines and @ref records take the line or record that starts in their range, so they can
+    /// be run over these independently and between them see everything once.
+    static std::vector<byte_range> split(byte_range r, std::size_t parts);
+
+  private:
+    const char * p;
+    std::size_t n;
+  };
+
+  namespace detail {
+    /// read a native endian length prefix of type @p Length at @p at
+    template <typename Length> Length read_prefix(const char * at) noexcept {
+      Length result;
+      std::memcpy(&result, at, sizeof(Length));
+      return result;
+    }
+  }
+
+  /// @brief Every line that starts in a range of a @ref mapped_file, without its newline.
+  ///
+  /// A line belongs to the range its first byte is in, so ranges from @ref mapped_file::split divide a file's lines between them.
+  /// A final line without a newline is still a line.
+  struct lines_enumerator : enumerator_expr<lines_enumerator, slice> {
+    const mapped_file * file;
+    byte_range range;
+    lines_enumerator(const mapped_file & file, byte_range range) : file(&file), range(range) {}
+
+    template <typename F> void foreach(F f) const {
+      const char * base = file->data();
+      std::size_t n = file->size(), last = std::min(range.last, n), i = std::min(range.first, n);
+      if (i >= last) return;
+      file->advise(byte_range { i, last }, mapped_file::willneed);
+      // the line running into our range belongs to whoever has its start
+      if (i > 0 && base[i - 1] != '\n') {
+        const void * nl = std::memchr(base + i, '\n', n - i);
+        if (nl == nullptr) return;
+        i = std::size_t(static_cast<const char *>(nl) - base) + 1;
+      }
+      while (i < last) {
+        const void * nl = std::memchr(base + i, '\n', n - i);
+        std::size_t j = nl ? std::size_t(static_cast<const char *>(nl) - base) : n;
+        f(slice(base + i, j - i));
+        i = j + 1;
+      }
+    }
+  };
+
+  /// the lines starting in @p range of @p file
+  inline lines_enumerator lines(const mapped_file & file, byte_range range) { return lines_enumerator(file, range); }
+  /// every line of @p file
+  inline lines_enumerator lines(const mapped_file & file) { return lines_enumerator(file, file.all()); }
+
+  /// @brief Every @ref width byte record that starts in a range of a @ref mapped_file.
+  ///
+  /// Records start at multiples of @ref width from the start of the file. A partial record at the end is left out.
+  struct records_enumerator : enumerator_expr<records_enumerator, slice> {
+    const mapped_file * file;
+    byte_range range;
+    std::size_t width;
+    records_enumerator(const mapped_file & file, std::size_t width, byte_range range) : file(&file), range(range), width(width) {
+      if (width == 0) throw std::invalid_argument("fib::records: zero width");
+    }
+
+    template <typename F> void foreach(F f) const {
+      const char * base = file->data();
+      std::size_t whole = file->size() / width * width;
+      std::size_t last = std::min(range.last, whole);
+      std::size_t i = (range.first + width - 1) / width * width; // round up to a record boundary
+      if (i >= last) return;
+      file->advise(byte_range { i, last }, mapped_file::willneed);
+      for (; i < last; i += width) f(slice(base + i, width));
+    }
+  };
+
+  /// the @p width byte records starting in @p range of @p file
+  inline records_enumerator records(const mapped_file & file, std::size_t width, byte_range range) { return records_enumerator(file, width, range); }
+  /// every @p width byte record of @p file
+  inline records_enumerator records(const mapped_file & file, std::size_t width) { return records_enumerator(file, width, file.all()); }
+
+  /// @brief Every record in a range of a @ref mapped_file holding records each preceded by its length, as a native endian @p Length.
+  ///
+  /// The slices are the payloads, without their prefixes. Record boundaries can't be found from an arbitrary offset, so the range
+  /// must start on one: use @ref split_prefixed rather than @ref mapped_file::split. Throws @p std::runtime_error on a truncated record.
+  template <typename Length = std::uint32_t> struct prefixed_records_enumerator : enumerator_expr<prefixed_records_enumerator<Length>, slice> {
+    const mapped_file * file;
+    byte_range range;
+    prefixed_records_enumerator(const mapped_file & file, byte_range range) : file(&file), range(range) {}
+
+    template <typename F> void foreach(F f) const {
+      const char * base = file->data();
+      std::size_t n = file->size(), last = std::min(range.last, n), i = range.first;
+      if (i >= last) return;
+      file->advise(byte_range { i, last }, mapped_file::willneed);
+      while (i < last) {
+        if (n - i < sizeof(Length)) throw std::runtime_error("fib::prefixed_records: truncated length");
+        std::size_t len = std::size_t(detail::read_prefix<Length>(base + i));
+        i += sizeof(Length);
+        if (n - i < len) throw std::runtime_error("fib::prefixed_records: truncated record");
+        f(slice(base + i, len));
+        i += len;
+      }
+    }
+  };
+
+  /// the length prefixed records in @p range of @p file, which must start on a record boundary
+  template <typename Length = std::uint32_t> prefixed_records_enumerator<Length> prefixed_records(const mapped_file & file, byte_range range) {
+    return prefixed_records_enumerator<Length>(file, range);
+  }
+  /// every length prefixed record of @p file
+  template <typename Length = std::uint32_t> prefixed_records_enumerator<Length> prefixed_records(const mapped_file & file) {
+    return prefixed_records_enumerator<Length>(file, file.all());
+  }
+
+  /// @brief Cut a file of length prefixed records into @p parts ranges of about the same size, on record boundaries.
+  ///
+  /// Hops from prefix to prefix, so only touches the pages holding them. Parts may come out empty if records are large.
+  template <typename Length = std::uint32_t> std::vector<byte_range> split_prefixed(const mapped_file & file, std::size_t parts) {
+    std::vector<byte_range> result;
+    if (parts == 0) return result;
+    const char * base = file.data();
+    std::size_t n = file.size(), i = 0, first = 0;
+    for (std::size_t k = 1; k < parts; ++k) {
+      std::size_t target = n / parts * k;
+      while (i < target && n - i >= sizeof(Length)) {
+        std::size_t len = std::size_t(detail::read_prefix<Length>(base + i));
+        if (n - i - sizeof(Length) < len) break; // truncated: leave it for the enumerator to report
+        i += sizeof(Length) + len;
+      }
+      result.push_back(byte_range { first, i });
+      first = i;
+    }
+    result.push_back(byte_range { first, n });
+    return result;
+  }
+}
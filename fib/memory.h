@@ -2,6 +2,8 @@
 
 #include "memory/isolated.h"
 #include "memory/aligned_allocator.h"
+#include "memory/arena.h"
+#include "memory/per_worker.h"
 
 /// @file memory.h
 /// @brief @ref fib::memory
@@ -0,0 +1,258 @@
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#include "fib/memory/aligned_allocator.h"
+#include "fib/memory/isolated.h"
+
+/// @file fib/memory/aligned_allocator.cpp
+/// @brief a per-thread size-class slab heap backing @ref fib::memory::aligned_allocator
+///
+/// Small requests are carved out of 64k chunks, each dedicated to a single power-of-two size class
+/// and owned by a single thread's heap. Every chunk is aligned to its own size, so the header for any
+/// block can be found by masking the pointer. Frees from the owning thread go straight onto a local
+/// free list. Frees from any other thread are gathered into a batch and handed back to the owner
+/// with a single compare-and-swap, where they are reclaimed the next time the owner runs short.
+///
+/// Large requests get a chunk of their own, with the same header layout, so deallocation doesn't need to
+/// know the size.
+
+namespace fib {
+  namespace memory {
+    namespace detail {
+      /// @cond PRIVATE
+      namespace {
+        const std::size_t chunk_size = 64 * 1024; ///< slab size, also the alignment used to find a chunk header
+        const std::size_t min_shift = 5;          ///< smallest block is 32 bytes
+        const std::size_t max_shift = 13;         ///< largest slab-allocated block is 8k
+        const std::size_t classes = max_shift - min_shift + 1;
+        const std::size_t batch_size = 32;        ///< remote frees accumulated before returning them to their owner
+
+        struct heap;
+
+        struct block {
+          block * next;
+        };
+
+        /// Lives at the start of every chunk. @p owner is null for large allocations.
+        struct chunk {
+          heap * owner;
+          std::size_t size_class;
+        };
+
+        /// The slab bookkeeping for a single thread.
+        struct heap {
+          block * free[classes];  ///< blocks ready for reuse by the owner
+          char * bump[classes];   ///< unused tail of the current chunk for each class
+          char * limit[classes];
+
+          memory::isolated<std::atomic<block*>> remote; ///< blocks freed by other threads, pushed in batches
+
+          // outgoing batch of blocks freed by this thread on behalf of another heap
+          heap * pending_owner;
+          block * pending_head;
+          block * pending_tail;
+          std::size_t pending_count;
+
+          heap * next_orphan;
+
+          heap() : pending_owner(nullptr), pending_head(nullptr), pending_tail(nullptr), pending_count(0), next_orphan(nullptr) {
+            for (std::size_t i = 0; i < classes; ++i) {
+              free[i] = nullptr;
+              bump[i] = limit[i] = nullptr;
+            }
+            remote.data.store(nullptr, std::memory_order_relaxed);
+          }
+        };
+
+        void * system_allocate(std::size_t align, std::size_t size) noexcept {
+#ifdef _WIN32
+          return _aligned_malloc(size, align);
+#else
+          void * p;
+          return posix_memalign(&p, align, size) == 0 ? p : nullptr;
+#endif
+        }
+
+        void system_deallocate(void * p) noexcept {
+#ifdef _WIN32
+          _aligned_free(p);
+#else
+          std::free(p);
+#endif
+        }
+
+        inline chunk * chunk_of(void * p) noexcept {
+          return reinterpret_cast<chunk*>(reinterpret_cast<std::uintptr_t>(p) & ~std::uintptr_t(chunk_size - 1));
+        }
+
+        inline std::size_t size_class_of(std::size_t n) noexcept {
+          std::size_t shift = min_shift;
+          while ((std::size_t(1) << shift) < n) ++shift;
+          return shift - min_shift;
+        }
+
+        // push a chain of blocks onto another heap's remote free list
+        void give_back(heap * owner, block * head, block * tail) noexcept {
+          block * top = owner->remote.data.load(std::memory_order_relaxed);
+          do {
+            tail->next = top;
+          } while (!owner->remote.data.compare_exchange_weak(top, head, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        void flush_pending(heap & h) noexcept {
+          if (h.pending_head != nullptr) give_back(h.pending_owner, h.pending_head, h.pending_tail);
+          h.pending_owner = nullptr;
+          h.pending_head = h.pending_tail = nullptr;
+          h.pending_count = 0;
+        }
+
+        // heaps of threads that have exited, waiting to be adopted by new threads
+        std::mutex orphan_mutex;
+        heap * orphans = nullptr;
+
+        heap * acquire_heap() {
+          {
+            std::lock_guard<std::mutex> lock(orphan_mutex);
+            if (orphans != nullptr) {
+              heap * h = orphans;
+              orphans = h->next_orphan;
+              h->next_orphan = nullptr;
+              return h;
+            }
+          }
+          void * p = system_allocate(alignof(heap) < 64 ? 64 : alignof(heap), sizeof(heap));
+          if (p == nullptr) throw std::bad_alloc();
+          return new (p) heap();
+        }
+
+        void release_heap(heap * h) noexcept {
+          flush_pending(*h);
+          std::lock_guard<std::mutex> lock(orphan_mutex);
+          h->next_orphan = orphans;
+          orphans = h;
+        }
+
+        thread_local heap * current_heap = nullptr;
+
+        // Heaps are never freed: blocks may still be in flight to them. Instead they are orphaned on thread exit.
+        struct heap_guard {
+          heap * h;
+          ~heap_guard() {
+            if (h != nullptr) {
+              current_heap = nullptr;
+              release_heap(h);
+            }
+          }
+        };
+
+        thread_local heap_guard guard = { nullptr };
+
+        heap & local_heap() {
+          heap * h = current_heap;
+          if (h == nullptr) {
+            h = current_heap = acquire_heap();
+            guard.h = h;
+          }
+          return *h;
+        }
+
+        // move everything other threads have handed back to us onto our local free lists
+        void reclaim(heap & h) noexcept {
+          block * b = h.remote.data.exchange(nullptr, std::memory_order_acquire);
+          while (b != nullptr) {
+            block * next = b->next;
+            std::size_t c = chunk_of(b)->size_class;
+            b->next = h.free[c];
+            h.free[c] = b;
+            b = next;
+          }
+        }
+
+        void * refill(heap & h, std::size_t c) {
+          flush_pending(h);
+          reclaim(h);
+          if (block * b = h.free[c]) {
+            h.free[c] = b->next;
+            return b;
+          }
+          std::size_t n = std::size_t(1) << (c + min_shift);
+          if (h.bump[c] == h.limit[c]) {
+            void * p = system_allocate(chunk_size, chunk_size);
+            if (p == nullptr) throw std::bad_alloc();
+            chunk * k = new (p) chunk;
+            k->owner = &h;
+            k->size_class = c;
+            // blocks are naturally aligned to their size, so skip at least one block to make room for the header
+            std::size_t offset = n < sizeof(chunk) ? (sizeof(chunk) + n - 1) & ~(n - 1) : n;
+            h.bump[c] = static_cast<char*>(p) + offset;
+            h.limit[c] = static_cast<char*>(p) + chunk_size;
+          }
+          void * result = h.bump[c];
+          h.bump[c] += n;
+          return result;
+        }
+
+        void * allocate_large(std::size_t align, std::size_t size) {
+          std::size_t offset = sizeof(chunk) < align ? align : (sizeof(chunk) + align - 1) & ~(align - 1);
+          if (size > std::size_t(~0) - offset) throw std::bad_alloc();
+          void * p = system_allocate(chunk_size, offset + size);
+          if (p == nullptr) throw std::bad_alloc();
+          chunk * k = new (p) chunk;
+          k->owner = nullptr;
+          k->size_class = 0;
+          return static_cast<char*>(p) + offset;
+        }
+      }
+      /// @endcond
+
+      void * allocate_aligned_memory(size_t align, size_t size) {
+        assert(align != 0 && (align & (align - 1)) == 0); // align is a power of two
+        // the chunk header has to be reachable by masking, so we can't hand out anything aligned to the chunk size itself
+        if (align >= chunk_size) throw std::bad_alloc();
+        std::size_t n = size < align ? align : size;
+        if (n > (std::size_t(1) << max_shift)) return allocate_large(align, size);
+        heap & h = local_heap();
+        std::size_t c = size_class_of(n);
+        if (block * b = h.free[c]) {
+          h.free[c] = b->next;
+          return b;
+        }
+        return refill(h, c);
+      }
+
+      void deallocate_aligned_memory(void * ptr) noexcept {
+        if (ptr == nullptr) return;
+        chunk * k = chunk_of(ptr);
+        heap * owner = k->owner;
+        if (owner == nullptr) {
+          system_deallocate(k);
+          return;
+        }
+        block * b = static_cast<block*>(ptr);
+        heap * h = current_heap;
+        if (owner == h) {
+          b->next = h->free[k->size_class];
+          h->free[k->size_class] = b;
+        } else if (h == nullptr) {
+          // no heap of our own to batch in (e.g. during thread teardown), so hand it back directly
+          b->next = nullptr;
+          give_back(owner, b, b);
+        } else {
+          if (h->pending_owner != owner) {
+            flush_pending(*h);
+            h->pending_owner = owner;
+            h->pending_tail = b;
+          }
+          b->next = h->pending_head;
+          h->pending_head = b;
+          if (++h->pending_count >= batch_size) flush_pending(*h);
+        }
+      }
+    }
+  }
+}
@@ -10,7 +10,10 @@
 namespace fib {
   namespace memory {
     namespace detail {
+      /// Allocate @p size bytes aligned to @p align, which must be a power of two smaller than 64k.
+      /// Small requests are served from a per-thread slab heap. Never returns null.
       FIB_DECLSPEC_NOALIAS FIB_DECLSPEC_RESTRICT void* allocate_aligned_memory(size_t align, size_t size) FIB_ATTRIBUTE_ALLOC_ALIGN(1) FIB_ATTRIBUTE_ALLOC_SIZE(2) FIB_ATTRIBUTE_MALLOC FIB_ATTRIBUTE_RETURNS_NONNULL;
+      /// Release memory obtained from @ref allocate_aligned_memory. Safe to call from any thread.
       void deallocate_aligned_memory(void* ptr) noexcept;
     }
   
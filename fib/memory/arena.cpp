@@ -0,0 +1,66 @@
+#include "fib/memory/arena.h"
+
+/// @file fib/memory/arena.cpp
+/// @brief out of line parts of @ref fib::memory::arena
+
+namespace fib {
+  namespace memory {
+    /// @cond PRIVATE
+    namespace {
+      thread_local arena * current_arena = nullptr;
+    }
+    /// @endcond
+
+    arena::arena() noexcept : bump(nullptr), limit(nullptr), pages(nullptr) {
+      for (std::size_t i = 0; i < classes; ++i) free[i] = nullptr;
+      remote.data.store(nullptr, std::memory_order_relaxed);
+    }
+
+    arena::~arena() {
+      while (pages != nullptr) {
+        void * next = *static_cast<void**>(pages);
+        detail::deallocate_aligned_memory(pages);
+        pages = next;
+      }
+    }
+
+    // never inlined: a fiber may resume on another thread, so the thread local must be looked up afresh
+    arena * arena::current() noexcept {
+      return current_arena;
+    }
+
+    arena::scope::scope(arena & a) noexcept : previous(current_arena) {
+      current_arena = &a;
+    }
+
+    arena::scope::~scope() {
+      current_arena = previous;
+    }
+
+    void * arena::refill(std::size_t c) {
+      // take back everything other threads have freed
+      block * b = remote.data.exchange(nullptr, std::memory_order_acquire);
+      while (b != nullptr) {
+        block * next = b->next;
+        b->next = free[b->size_class];
+        free[b->size_class] = b;
+        b = next;
+      }
+      if (block * r = free[c]) {
+        free[c] = r->next;
+        return r;
+      }
+      std::size_t n = (c + 1) * granularity;
+      if (std::size_t(limit - bump) < n) {
+        char * page = static_cast<char*>(detail::allocate_aligned_memory(granularity, page_size));
+        *reinterpret_cast<void**>(page) = pages;
+        pages = page;
+        bump = page + granularity;
+        limit = page + page_size;
+      }
+      void * result = bump;
+      bump += n;
+      return result;
+    }
+  }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+#include "fib/attribute.h"
+#include "fib/memory/aligned_allocator.h"
+#include "fib/memory/isolated.h"
+
+/// @file fib/memory/arena.h
+/// @brief provides @ref fib::memory::arena and @ref fib::memory::arena_allocator
+
+namespace fib {
+  namespace memory {
+    /// @brief A pool allocator owned by a single worker.
+    ///
+    /// Small blocks are bump allocated out of pages and recycled through per-size free lists that only the
+    /// owning thread touches. Other threads freeing into the arena push onto a lock-free remote free list,
+    /// which the owner drains when it runs dry. Requests larger than @ref max_small go to the aligned heap.
+    ///
+    /// Pages are only returned when the arena is destroyed, so nothing allocated from an arena may outlive it.
+    struct arena {
+      static const std::size_t granularity = 16;     ///< size class spacing, and the alignment of every block
+      static const std::size_t max_small = 512;      ///< largest request served from the arena itself
+      static const std::size_t page_size = 32 * 1024; ///< bytes requested from the aligned heap at a time
+
+      arena() noexcept;
+      ~arena();
+
+      /// @cond PRIVATE
+      arena(const arena &) = delete;
+      arena & operator = (const arena &) = delete;
+      /// @endcond
+
+      /// Allocate @p n bytes aligned to @ref granularity. Only call this from the owning thread.
+      FIB_DECLSPEC_NOALIAS FIB_DECLSPEC_RESTRICT void * allocate(std::size_t n) FIB_ATTRIBUTE_MALLOC FIB_ATTRIBUTE_RETURNS_NONNULL {
+        if (n > max_small) return detail::allocate_aligned_memory(granularity, n);
+        std::size_t c = size_class(n);
+        if (block * b = free[c]) {
+          free[c] = b->next;
+          return b;
+        }
+        return refill(c);
+      }
+
+      /// Release @p n bytes at @p p back to this arena. Safe to call from any thread.
+      void deallocate(void * p, std::size_t n) noexcept {
+        if (n > max_small) {
+          detail::deallocate_aligned_memory(p);
+          return;
+        }
+        std::size_t c = size_class(n);
+        block * b = static_cast<block*>(p);
+        if (current() == this) {
+          b->next = free[c];
+          free[c] = b;
+        } else {
+          b->size_class = c;
+          block * top = remote.data.load(std::memory_order_relaxed);
+          do {
+            b->next = top;
+          } while (!remote.data.compare_exchange_weak(top, b, std::memory_order_release, std::memory_order_relaxed));
+        }
+      }
+
+      /// The arena bound to the current thread, if any. Inside a task this is the running worker's arena.
+      static arena * current() noexcept FIB_ATTRIBUTE_NOINLINE;
+
+      /// Binds an arena to the current thread for the lifetime of the scope.
+      struct scope {
+        explicit scope(arena & a) noexcept;
+        ~scope();
+      private:
+        arena * previous;
+      };
+
+    private:
+      struct block {
+        block * next;
+        std::size_t size_class; ///< only maintained for blocks on the remote free list
+      };
+      static_assert(sizeof(block) <= granularity, "arena blocks must be able to hold a free list entry");
+
+      static const std::size_t classes = max_small / granularity;
+
+      static std::size_t size_class(std::size_t n) noexcept {
+        return n == 0 ? 0 : (n - 1) / granularity;
+      }
+
+      void * refill(std::size_t c);
+
+      block * free[classes]; ///< recycled blocks, owner only
+      char * bump;           ///< unused tail of the current page
+      char * limit;
+      void * pages;          ///< every page we own, threaded through their first word
+      isolated<std::atomic<block*>> remote; ///< blocks freed by other threads
+    };
+
+    /// @brief A @p std::allocator compatible adaptor over an @ref arena.
+    ///
+    /// Default constructed instances allocate from the arena of the current worker, so containers built
+    /// inside a task share its storage. Outside of a worker they fall back to the aligned heap.
+    template <typename T> struct arena_allocator {
+      typedef T         value_type;
+      typedef T*        pointer;
+      typedef const T*  const_pointer;
+      typedef T&        reference;
+      typedef const T&  const_reference;
+      typedef size_t    size_type;
+      typedef ptrdiff_t difference_type;
+
+      /// @cond PRIVATE
+      template <class U> struct rebind { typedef arena_allocator<U> other; };
+      /// @endcond
+
+      arena_allocator() noexcept : source(arena::current()) {}
+      explicit arena_allocator(arena & a) noexcept : source(&a) {}
+      template <class U> arena_allocator(const arena_allocator<U> & that) noexcept : source(that.source) {}
+
+      size_type max_size() const noexcept {
+        return size_type(~0) / sizeof(T);
+      }
+
+      FIB_DECLSPEC_NOALIAS FIB_DECLSPEC_RESTRICT pointer allocate(size_type n, const void * = 0) FIB_ATTRIBUTE_MALLOC FIB_ATTRIBUTE_RETURNS_NONNULL {
+        static_assert(alignof(T) <= arena::granularity, "arena_allocator does not support over-aligned types");
+        if (n > max_size()) throw std::bad_alloc();
+        return static_cast<pointer>(source
+          ? source->allocate(n * sizeof(T))
+          : detail::allocate_aligned_memory(arena::granularity, n * sizeof(T)));
+      }
+
+      void deallocate(pointer p, size_type n) noexcept {
+        if (source) source->deallocate(p, n * sizeof(T));
+        else detail::deallocate_aligned_memory(p);
+      }
+
+      template <class U, class ...Args> void construct(U* p, Args&&... args) {
+        ::new(reinterpret_cast<void*>(p)) U(std::forward<Args>(args)...);
+      }
+
+      template <class U> void destroy(U * p) { p->~U(); }
+
+      arena * source; ///< where we get our memory, or nullptr for the aligned heap
+    };
+
+    template <typename T, typename U>
+    inline bool operator == (const arena_allocator<T> & a, const arena_allocator<U> & b) noexcept {
+      return a.source == b.source;
+    }
+
+    template <typename T, typename U>
+    inline bool operator != (const arena_allocator<T> & a, const arena_allocator<U> & b) noexcept {
+      return a.source != b.source;
+    }
+  }
+}
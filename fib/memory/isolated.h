@@ -9,42 +9,51 @@
 
 namespace fib {
   namespace memory {
+    /// @brief How far apart two objects written by different threads should be to avoid false sharing.
+    ///
+    /// 128 where cache lines are fetched in adjacent pairs (x86-64's spatial prefetcher) or are that big to begin with, 64 elsewhere.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__powerpc64__)
+    static const std::size_t hardware_destructive_interference_size = 128;
+#else
+    static const std::size_t hardware_destructive_interference_size = 64;
+#endif
+
     /// @brief @ref isolated<T> tries to ensure that T gets its own cache line.
     /// @param T type
     /// @param N padding_bytes
-    template <typename T, std::size_t N = 64> 
+    template <typename T, std::size_t N = hardware_destructive_interference_size>
     struct isolated {
-      static const std::size_t padding_bytes = N; ///< The number of bytes of padding before the item. The same amount of padding, minus the size of the item is applied after as well.
-      typedef T type;                        ///< The type of content we're storing. Assumes sizeof(T) < N.
-  
+      static const std::size_t padding_bytes = N; ///< The number of bytes of padding before the item. Enough is applied after to round the item up to a multiple of N.
+      typedef T type;                        ///< The type of content we're storing.
+
       /// copy constructor
       isolated(const isolated<T,N> & that) : data(that.data) {}
-  
+
       /// move constructor
-      isolated(T && data) : data(std::forward(data)) {}
-  
+      isolated(T && data) : data(std::move(data)) {}
+
       /// pass-through constructor
-      template <typename ... U> isolated(U&&...args) : data(std::forward(args)...) {}
-  
+      template <typename ... U> isolated(U&&...args) : data(std::forward<U>(args)...) {}
+
       /// content assignment operator
       template <typename U> isolated & operator = (U && t) {
-        data = t;
+        data = std::forward<U>(t);
         return *this;
       }
-  
+
       /// assignment operator
-      isolated & operator = (isolated & that) {
+      isolated & operator = (const isolated & that) {
         data = that.data;
         return *this;
       }
-  
+
     private:
       std::int8_t padding0[padding_bytes];
     public:
       /// The isolated contents
       T data;
     private:
-      std::int8_t padding1[padding_bytes - sizeof(T)];
+      std::int8_t padding1[padding_bytes - sizeof(T) % padding_bytes];
     };
   }
 }
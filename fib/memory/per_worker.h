@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "fib/memory/aligned_allocator.h"
+#include "fib/memory/isolated.h"
+#include "fib/worker.h"
+
+/// @file fib/memory/per_worker.h
+/// @brief provides @ref fib::memory::per_worker
+
+namespace fib {
+  namespace memory {
+    /// @brief One @p T for each worker of a pool, each on cache lines of its own.
+    ///
+    /// Slots are laid out @ref stride bytes apart in a single block from the aligned heap, with every slot starting on a
+    /// @ref hardware_destructive_interference_size boundary, so neighbouring workers never false share and @p T may be any size.
+    /// Indexing by a worker is a multiply and an add.
+    template <typename T> struct per_worker {
+      typedef T value_type;
+
+      /// how slots are aligned
+      static const std::size_t alignment = alignof(T) > hardware_destructive_interference_size ? alignof(T) : hardware_destructive_interference_size;
+      /// the distance between consecutive slots
+      static const std::size_t stride = (sizeof(T) + alignment - 1) / alignment * alignment;
+
+      /// @brief @p n slots, each constructed from @p args
+      template <typename ... Args> explicit per_worker(std::size_t n = max_workers, const Args & ... args)
+        : n(n), storage(static_cast<char *>(detail::allocate_aligned_memory(alignment, n * stride))) {
+        std::size_t i = 0;
+        try {
+          for (; i < n; ++i) new (storage + i * stride) T(args...);
+        } catch (...) {
+          while (i-- > 0) (*this)[i].~T();
+          detail::deallocate_aligned_memory(storage);
+          throw;
+        }
+      }
+
+      /// @brief a slot for each worker of @p p, each constructed from @p args
+      template <typename ... Args> explicit per_worker(const pool & p, const Args & ... args) : per_worker(std::size_t(p.N), args...) {}
+
+      ~per_worker() {
+        for (std::size_t i = 0; i < n; ++i) (*this)[i].~T();
+        detail::deallocate_aligned_memory(storage);
+      }
+
+      /// @cond PRIVATE
+      per_worker(const per_worker &) = delete;
+      per_worker & operator = (const per_worker &) = delete;
+      /// @endcond
+
+      std::size_t size() const noexcept { return n; }
+
+      T & operator [](std::size_t i) noexcept { return *reinterpret_cast<T *>(storage + i * stride); }
+      const T & operator [](std::size_t i) const noexcept { return *reinterpret_cast<const T *>(storage + i * stride); }
+
+      /// the slot of worker @p w
+      T & operator [](const worker & w) noexcept { return (*this)[std::size_t(w.id)]; }
+      const T & operator [](const worker & w) const noexcept { return (*this)[std::size_t(w.id)]; }
+
+      /// @brief the slot of the worker running the current task. Inside a pool only.
+      ///
+      /// Don't keep it across anything that may suspend: the task may come back on another worker.
+      T & local() noexcept { return (*this)[*worker::current()]; }
+
+    private:
+      std::size_t n;
+      char * storage;
+    };
+  }
+}
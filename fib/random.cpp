@@ -0,0 +1,44 @@
+#include "random.h"
+
+/// @file random.cpp
+/// @brief the table behind @ref fib::xoshiro256::exponential
+
+namespace fib {
+  namespace detail {
+    // -ln((i + 0.5) / 256) for i in [0, 256)
+    const float unit_exponential[256] = {
+      6.238325f, 5.139712f, 4.628887f, 4.292414f, 4.041100f, 3.840429f, 3.673375f, 3.530274f,
+      3.405111f, 3.293886f, 3.193802f, 3.102830f, 3.019449f, 2.942488f, 2.871029f, 2.804337f,
+      2.741817f, 2.682977f, 2.627407f, 2.574763f, 2.524753f, 2.477125f, 2.431662f, 2.388177f,
+      2.346504f, 2.306499f, 2.268033f, 2.230991f, 2.195273f, 2.160787f, 2.127451f, 2.095190f,
+      2.063937f, 2.033632f, 2.004218f, 1.975645f, 1.947865f, 1.920837f, 1.894519f, 1.868877f,
+      1.843875f, 1.819484f, 1.795673f, 1.772417f, 1.749688f, 1.727465f, 1.705725f, 1.684448f,
+      1.663614f, 1.643205f, 1.623204f, 1.603596f, 1.584364f, 1.565496f, 1.546977f, 1.528794f,
+      1.510937f, 1.493392f, 1.476151f, 1.459201f, 1.442534f, 1.426140f, 1.410011f, 1.394138f,
+      1.378512f, 1.363127f, 1.347975f, 1.333050f, 1.318344f, 1.303851f, 1.289565f, 1.275480f,
+      1.261591f, 1.247892f, 1.234378f, 1.221045f, 1.207887f, 1.194900f, 1.182079f, 1.169420f,
+      1.156920f, 1.144574f, 1.132379f, 1.120331f, 1.108426f, 1.096661f, 1.085033f, 1.073539f,
+      1.062175f, 1.050939f, 1.039828f, 1.028838f, 1.017969f, 1.007216f, 0.996578f, 0.986051f,
+      0.975634f, 0.965325f, 0.955121f, 0.945020f, 0.935020f, 0.925119f, 0.915315f, 0.905606f,
+      0.895990f, 0.886466f, 0.877032f, 0.867687f, 0.858427f, 0.849253f, 0.840162f, 0.831153f,
+      0.822224f, 0.813375f, 0.804603f, 0.795907f, 0.787286f, 0.778739f, 0.770264f, 0.761861f,
+      0.753528f, 0.745263f, 0.737066f, 0.728936f, 0.720872f, 0.712872f, 0.704935f, 0.697061f,
+      0.689249f, 0.681497f, 0.673804f, 0.666171f, 0.658595f, 0.651076f, 0.643613f, 0.636206f,
+      0.628853f, 0.621554f, 0.614307f, 0.607113f, 0.599970f, 0.592878f, 0.585835f, 0.578842f,
+      0.571898f, 0.565001f, 0.558152f, 0.551349f, 0.544592f, 0.537881f, 0.531214f, 0.524592f,
+      0.518013f, 0.511477f, 0.504983f, 0.498532f, 0.492121f, 0.485752f, 0.479423f, 0.473134f,
+      0.466884f, 0.460672f, 0.454499f, 0.448364f, 0.442267f, 0.436206f, 0.430182f, 0.424194f,
+      0.418242f, 0.412325f, 0.406442f, 0.400594f, 0.394780f, 0.389000f, 0.383253f, 0.377538f,
+      0.371857f, 0.366207f, 0.360589f, 0.355002f, 0.349447f, 0.343922f, 0.338427f, 0.332963f,
+      0.327528f, 0.322123f, 0.316746f, 0.311399f, 0.306079f, 0.300788f, 0.295525f, 0.290290f,
+      0.285081f, 0.279900f, 0.274745f, 0.269617f, 0.264515f, 0.259439f, 0.254388f, 0.249363f,
+      0.244363f, 0.239388f, 0.234438f, 0.229511f, 0.224609f, 0.219731f, 0.214877f, 0.210046f,
+      0.205238f, 0.200454f, 0.195692f, 0.190952f, 0.186235f, 0.181541f, 0.176868f, 0.172217f,
+      0.167587f, 0.162979f, 0.158391f, 0.153825f, 0.149280f, 0.144755f, 0.140250f, 0.135766f,
+      0.131302f, 0.126857f, 0.122432f, 0.118027f, 0.113641f, 0.109274f, 0.104927f, 0.100598f,
+      0.096287f, 0.091995f, 0.087722f, 0.083467f, 0.079229f, 0.075010f, 0.070808f, 0.066624f,
+      0.062457f, 0.058308f, 0.054176f, 0.050061f, 0.045962f, 0.041880f, 0.037815f, 0.033767f,
+      0.029735f, 0.025719f, 0.021719f, 0.017734f, 0.013766f, 0.009814f, 0.005877f, 0.001955f
+    };
+  }
+}
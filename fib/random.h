@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+/// @file random.h
+/// @brief @ref fib::xoshiro256, the small fast generator each worker carries
+
+namespace fib {
+
+  namespace detail {
+    /// the unit exponential distribution at the midpoint of each of 256 equal steps of probability. mean 0.9986
+    extern const float unit_exponential[256];
+
+    /// one step of splitmix64, for spreading a single seed over a larger state
+    inline std::uint64_t splitmix64(std::uint64_t & x) noexcept {
+      std::uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+  }
+
+  /// @brief xoshiro256**: 32 bytes of state, a handful of cycles a draw, and a period of 2^256 - 1.
+  ///
+  /// A standard uniform random bit generator, so it works with the @p <random> distributions, but @ref below and
+  /// @ref exponential cover what the scheduler needs without them: no division, and no @p log.
+  /// Not for cryptography.
+  struct xoshiro256 {
+    typedef std::uint64_t result_type;
+
+    static constexpr result_type min() noexcept { return 0; }
+    static constexpr result_type max() noexcept { return std::numeric_limits<result_type>::max(); }
+
+    explicit xoshiro256(std::uint64_t seed = 0) noexcept {
+      for (int i = 0; i < 4; ++i) s[i] = detail::splitmix64(seed);
+    }
+
+    /// seed from a @p std::seed_seq or the like
+    template <typename SeedSeq, typename = typename std::enable_if<
+      !std::is_integral<SeedSeq>::value && !std::is_same<typename std::decay<SeedSeq>::type, xoshiro256>::value
+    >::type>
+    explicit xoshiro256(SeedSeq & seq) {
+      std::uint32_t w[8];
+      seq.generate(w, w + 8);
+      for (int i = 0; i < 4; ++i) s[i] = std::uint64_t(w[2 * i]) << 32 | w[2 * i + 1];
+      if ((s[0] | s[1] | s[2] | s[3]) == 0) s[0] = 1; // the one state we can't leave
+    }
+
+    result_type operator()() noexcept {
+      std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+      std::uint64_t t = s[1] << 17;
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = rotl(s[3], 45);
+      return result;
+    }
+
+    /// @brief uniform on [0, @p n), by multiplying rather than dividing.
+    ///
+    /// Biased by at most @p n / 2^32, which is nothing when picking one of a few workers.
+    std::uint32_t below(std::uint32_t n) noexcept {
+      return std::uint32_t((((*this)() >> 32) * n) >> 32);
+    }
+
+    /// exponentially distributed with mean 1, to within the 256 steps of @ref detail::unit_exponential
+    float exponential() noexcept {
+      return detail::unit_exponential[(*this)() >> 56];
+    }
+
+  private:
+    std::uint64_t s[4];
+
+    static std::uint64_t rotl(std::uint64_t x, int k) noexcept { return (x << k) | (x >> (64 - k)); }
+  };
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#include "memory/per_worker.h"
+#include "sync.h"
+#include "worker.h"
+
+/// @file reducer.h
+/// @brief @ref fib::reducer and @ref fib::sharded_counter
+
+namespace fib {
+
+  /// @brief Monoids to reduce with.
+  ///
+  /// A monoid supplies @p identity() and combines with @p operator()(T & into, const U & x), folding @p x into @p into.
+  /// The reduction is folded per worker rather than in task order, so the operation should be commutative as well as
+  /// associative.
+  namespace monoid {
+    /// addition, starting from a value initialized @p T
+    template <typename T> struct sum {
+      T identity() const { return T(); }
+      template <typename U> void operator()(T & into, const U & x) const { into += x; }
+    };
+
+    /// the least value seen, starting from @p top
+    template <typename T> struct min {
+      T top;
+      explicit min(const T & top = T()) : top(top) {}
+      T identity() const { return top; }
+      template <typename U> void operator()(T & into, const U & x) const { if (x < into) into = x; }
+    };
+
+    /// the greatest value seen, starting from @p bottom
+    template <typename T> struct max {
+      T bottom;
+      explicit max(const T & bottom = T()) : bottom(bottom) {}
+      T identity() const { return bottom; }
+      template <typename U> void operator()(T & into, const U & x) const { if (into < x) into = x; }
+    };
+  }
+
+  /// @brief A reduction variable, or hyperobject: one view of a @p T per worker, folded together on demand.
+  ///
+  /// Each worker updates its own view in its own cache line, with no atomics and no sharing, so parallel loops can
+  /// accumulate into one of these without serializing. Threads outside of any pool share one more view, under a lock.
+  ///
+  /// Reading folds the views, so it is only meaningful at a join point, once every task updating it has been waited for.
+  /// All updates should come from a single pool, as views are picked by worker id.
+  template <typename T, typename Monoid = monoid::sum<T>>
+  struct reducer {
+    typedef T value_type;
+
+    explicit reducer(const Monoid & m = Monoid()) : m(m), views(max_workers, m.identity()), outside(m.identity()) {}
+
+    /// @cond PRIVATE
+    reducer(const reducer &) = delete;
+    reducer & operator = (const reducer &) = delete;
+    /// @endcond
+
+    /// fold @p x into the current worker's view
+    template <typename U> void update(const U & x) {
+      if (worker * w = worker::current()) m(views[*w], x);
+      else {
+        std::lock_guard<detail::spinlock> guard(lock);
+        m(outside, x);
+      }
+    }
+
+    /// @brief the current worker's view, to update in place.
+    ///
+    /// Don't keep it across anything that may suspend: the task may come back on another worker. Inside a pool only.
+    T & local() noexcept {
+      return views.local();
+    }
+
+    /// fold every view together
+    T get() const {
+      T result = m.identity();
+      for (std::size_t i = 0; i < views.size(); ++i) m(result, views[i]);
+      std::lock_guard<detail::spinlock> guard(lock);
+      m(result, outside);
+      return result;
+    }
+
+    /// fold every view together, and reset them all to the identity
+    T take() {
+      T result = m.identity();
+      for (std::size_t i = 0; i < views.size(); ++i) {
+        m(result, views[i]);
+        views[i] = m.identity();
+      }
+      std::lock_guard<detail::spinlock> guard(lock);
+      m(result, outside);
+      outside = m.identity();
+      return result;
+    }
+
+    /// reset every view to the identity
+    void clear() {
+      for (std::size_t i = 0; i < views.size(); ++i) views[i] = m.identity();
+      outside = m.identity();
+    }
+
+  private:
+    Monoid m;
+    memory::per_worker<T> views;   ///< one per worker id
+    mutable detail::spinlock lock; ///< guards @ref outside
+    T outside;                     ///< the view of threads outside of any pool
+  };
+
+  /// @brief A counter that scales with the number of workers incrementing it.
+  ///
+  /// Each worker counts in its own cache line, so increments from different workers never contend. Shards are picked by
+  /// worker id, which is only unique within a pool, so workers of several pools may share one: increments are relaxed
+  /// atomic adds, which are cheap on a line nobody else is writing. Threads outside of any pool share one more shard.
+  ///
+  /// Unlike @ref reducer, this may be read at any time, but a read that races with increments sees some of them and not others.
+  struct sharded_counter {
+    sharded_counter() : shards(max_workers, 0) {
+      outside.store(0, std::memory_order_relaxed);
+    }
+
+    /// @cond PRIVATE
+    sharded_counter(const sharded_counter &) = delete;
+    sharded_counter & operator = (const sharded_counter &) = delete;
+    /// @endcond
+
+    void add(std::int64_t n = 1) noexcept {
+      if (worker * w = worker::current()) {
+        shards[*w].fetch_add(n, std::memory_order_relaxed);
+      } else outside.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    sharded_counter & operator ++ () noexcept {
+      add(1);
+      return *this;
+    }
+
+    sharded_counter & operator += (std::int64_t n) noexcept {
+      add(n);
+      return *this;
+    }
+
+    /// the sum over every shard
+    std::int64_t value() const noexcept {
+      std::int64_t result = outside.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < shards.size(); ++i) result += shards[i].load(std::memory_order_relaxed);
+      return result;
+    }
+
+  private:
+    memory::per_worker<std::atomic<std::int64_t>> shards; ///< one per worker id
+    std::atomic<std::int64_t> outside;                    ///< shared by threads outside of any pool
+  };
+}
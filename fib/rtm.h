@@ -1,11 +1,20 @@
 #pragma once
 
-#ifdef __RTM__
+#include <cstdint>
+
+#include "fib/attribute.h"
+#include "fib/cpu.h"
+
+// The instructions below are emitted as raw bytes, so we don't need the compiler to target RTM, just x86
+#if defined(__RTM__) || ((defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__))
 #define FIB_RTM
 #endif
 
 /// @file fib/rtm.h
 /// @brief Restricted Transactional Memory
+///
+/// @p FIB_RTM means we know how to emit these instructions. Whether the processor we wind up running on
+/// will execute them is another matter: check @ref rtm_supported before calling @ref rtm_begin.
 
 /// @defgroup rtm RTM
 /// @brief Restricted Transactional Memory
@@ -13,6 +22,15 @@
 /// @{
 
 namespace fib {
+  /// Can we execute transactions on this machine? Fixed after startup.
+  static inline bool rtm_supported() noexcept {
+#ifdef FIB_RTM
+    return cpu().rtm;
+#else
+    return false;
+#endif
+  }
+
 #ifdef FIB_RTM
   static const uint32_t rtm_started = ~0U;            ///< result of rtm_begin if it works
   static const uint32_t rtm_status_explicit = 1 << 0; ///< rtm_abort called explicitly
@@ -0,0 +1,250 @@
+#include "sync.h"
+#include "worker.h"
+
+/// @file sync.cpp
+/// @brief fiber aware synchronization primitives
+
+namespace fib {
+  namespace detail {
+    void waiter::wake() noexcept {
+      if (fiber == nullptr) {
+        blocked_thread & t = *thread;
+        std::lock_guard<std::mutex> lock(t.m);
+        t.done = true;
+        t.cv.notify_one();
+        return;
+      }
+      // prefer the worker doing the waking, whose cache holds whatever we were waiting on. fibers belong to their
+      // pool, which frees their stacks and keeps count of them, so a waker from elsewhere hands them back home
+      worker * w = worker::current();
+      if (w != nullptr && &w->p == home) w->schedule(task(fiber));
+      else home->resume(fiber);
+    }
+
+    /// @cond PRIVATE
+    namespace {
+      /// what the alarm of a timed wait runs: take the waiter out of line, if it is still in it, and wake it
+      struct expiry {
+        waiter * w;
+        wait_queue * q;
+        spinlock * lock;
+        void operator ()(worker &) const noexcept {
+          // whoever popped us instead failed to claim us, and left the waking to us
+          lock->lock();
+          q->remove(w);
+          lock->unlock();
+          w->timed_out = true;
+          w->wake();
+        }
+      };
+    }
+    /// @endcond
+
+    void block(waiter & w, wait_queue & q, spinlock & lock) {
+      q.push(&w);
+      if (worker * current = worker::current()) {
+        w.home = &current->p;
+        worker::suspend([&w, &lock](detail::fiber * self) {
+          w.fiber = self;
+          lock.unlock(); // publishes us. from here on we may be resumed at any moment
+        });
+      } else {
+        blocked_thread t;
+        w.thread = &t;
+        lock.unlock();
+        std::unique_lock<std::mutex> g(t.m);
+        t.cv.wait(g, [&t] { return t.done; });
+      }
+    }
+
+    bool block_until(waiter & w, wait_queue & q, spinlock & lock, chrono::clock::time_point deadline) {
+      q.push(&w);
+      if (worker * current = worker::current()) {
+        w.home = &current->p;
+        w.timed = true;
+        worker::suspend([&w, &q, &lock, deadline](detail::fiber * self) {
+          w.fiber = self;
+          // nobody can claim us before we let go of the lock, so there's time to set the alarm
+          worker & v = *worker::current();
+          w.alarm = v.schedule_at(deadline, task(v.arena, expiry { &w, &q, &lock }));
+          lock.unlock(); // publishes us. from here on we may be resumed at any moment
+        });
+        return !w.timed_out;
+      }
+      blocked_thread t;
+      w.thread = &t;
+      lock.unlock();
+      std::unique_lock<std::mutex> g(t.m);
+      if (t.cv.wait_until(g, chrono::clock::to_steady(deadline), [&t] { return t.done; })) return true;
+      g.unlock();
+      lock.lock();
+      bool queued = q.remove(&w);
+      lock.unlock();
+      if (queued) return false;
+      // popped just in time by somebody who is on their way to wake us
+      g.lock();
+      t.cv.wait(g, [&t] { return t.done; });
+      return true;
+    }
+  }
+
+  void mutex::lock() {
+    guard.lock();
+    if (!locked) {
+      locked = true;
+      guard.unlock();
+      return;
+    }
+    detail::waiter w;
+    detail::block(w, waiters, guard); // whoever wakes us hands us the lock
+  }
+
+  bool mutex::try_lock_until(chrono::clock::time_point deadline) {
+    guard.lock();
+    if (!locked) {
+      locked = true;
+      guard.unlock();
+      return true;
+    }
+    detail::waiter w;
+    return detail::block_until(w, waiters, guard, deadline); // whoever wakes us hands us the lock
+  }
+
+  bool mutex::try_lock() noexcept {
+    if (!guard.try_lock()) return false;
+    bool acquired = !locked;
+    locked = true;
+    guard.unlock();
+    return acquired;
+  }
+
+  void mutex::unlock() noexcept {
+    guard.lock();
+    detail::waiter * w = waiters.pop();
+    if (w == nullptr) locked = false;
+    guard.unlock();
+    if (w) w->wake();
+  }
+
+  void condition_variable::notify_one() noexcept {
+    guard.lock();
+    detail::waiter * w = waiters.pop();
+    guard.unlock();
+    if (w) w->wake();
+  }
+
+  void condition_variable::notify_all() noexcept {
+    guard.lock();
+    detail::waiter * w = waiters.pop_all();
+    guard.unlock();
+    detail::wake_all(w);
+  }
+
+  void semaphore::acquire() {
+    guard.lock();
+    if (count > 0) {
+      --count;
+      guard.unlock();
+      return;
+    }
+    detail::waiter w;
+    detail::block(w, waiters, guard); // whoever wakes us hands us a unit
+  }
+
+  bool semaphore::try_acquire_until(chrono::clock::time_point deadline) {
+    guard.lock();
+    if (count > 0) {
+      --count;
+      guard.unlock();
+      return true;
+    }
+    detail::waiter w;
+    return detail::block_until(w, waiters, guard, deadline); // whoever wakes us hands us a unit
+  }
+
+  bool semaphore::try_acquire() noexcept {
+    guard.lock();
+    bool acquired = count > 0;
+    if (acquired) --count;
+    guard.unlock();
+    return acquired;
+  }
+
+  void semaphore::release(std::ptrdiff_t n) noexcept {
+    detail::waiter * head = nullptr, * tail = nullptr;
+    guard.lock();
+    for (; n > 0; --n) {
+      detail::waiter * w = waiters.pop();
+      if (w == nullptr) break;
+      w->next = nullptr;
+      if (tail) tail->next = w;
+      else head = w;
+      tail = w;
+    }
+    count += n;
+    guard.unlock();
+    detail::wake_all(head);
+  }
+
+  void latch::count_down(std::ptrdiff_t n) noexcept {
+    guard.lock();
+    count -= n;
+    detail::waiter * w = count <= 0 ? waiters.pop_all() : nullptr;
+    guard.unlock();
+    detail::wake_all(w);
+  }
+
+  bool latch::try_wait() const noexcept {
+    guard.lock();
+    bool done = count <= 0;
+    guard.unlock();
+    return done;
+  }
+
+  void latch::wait() {
+    guard.lock();
+    if (count <= 0) {
+      guard.unlock();
+      return;
+    }
+    detail::waiter w;
+    detail::block(w, waiters, guard);
+  }
+
+  bool latch::wait_until(chrono::clock::time_point deadline) {
+    guard.lock();
+    if (count <= 0) {
+      guard.unlock();
+      return true;
+    }
+    detail::waiter w;
+    return detail::block_until(w, waiters, guard, deadline);
+  }
+
+  void latch::arrive_and_wait(std::ptrdiff_t n) {
+    guard.lock();
+    count -= n;
+    if (count <= 0) {
+      detail::waiter * w = waiters.pop_all();
+      guard.unlock();
+      detail::wake_all(w);
+      return;
+    }
+    detail::waiter w;
+    detail::block(w, waiters, guard);
+  }
+
+  bool barrier::arrive_and_wait() {
+    guard.lock();
+    if (++arrived == participants) {
+      arrived = 0;
+      detail::waiter * w = waiters.pop_all();
+      guard.unlock();
+      detail::wake_all(w);
+      return true;
+    }
+    detail::waiter w;
+    detail::block(w, waiters, guard);
+    return false;
+  }
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "chrono.h"
+#include "fiber.h"
+#include "timer.h"
+
+/// @file sync.h
+/// @brief synchronization primitives that suspend fibers rather than block workers
+
+namespace fib {
+
+  struct pool;
+
+  namespace detail {
+    /// @brief A test and test-and-set lock guarding the innards of the primitives below.
+    ///
+    /// Only ever held for a handful of instructions, and never across a suspension.
+    struct spinlock {
+      spinlock() noexcept { locked.store(false, std::memory_order_relaxed); }
+
+      /// @cond PRIVATE
+      spinlock(const spinlock &) = delete;
+      spinlock & operator = (const spinlock &) = delete;
+      /// @endcond
+
+      void lock() noexcept {
+        for (int spins = 0; locked.exchange(true, std::memory_order_acquire); ++spins)
+          while (locked.load(std::memory_order_relaxed))
+            if (++spins > 64) std::this_thread::yield();
+      }
+
+      bool try_lock() noexcept {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+      }
+
+      void unlock() noexcept { locked.store(false, std::memory_order_release); }
+
+    private:
+      std::atomic<bool> locked;
+    };
+
+    /// a thread outside of any pool, blocked on one of our primitives
+    struct blocked_thread {
+      std::mutex m;
+      std::condition_variable cv;
+      bool done = false;
+    };
+
+    /// @brief Somebody waiting on a primitive. Lives on the waiter's own stack, and is linked into an intrusive @ref wait_queue.
+    struct waiter {
+      detail::fiber * fiber = nullptr;   ///< the suspended fiber, or nullptr when a thread outside of any pool is waiting
+      pool * home = nullptr;             ///< where to resume @ref fiber if whoever wakes it isn't running on one of its workers
+      blocked_thread * thread = nullptr; ///< set instead of @ref fiber for threads outside of any pool
+      waiter * next = nullptr;
+      void * slot = nullptr;             ///< used by @ref channel to hand a value straight over
+      bool ok = true;                    ///< used by @ref channel: false when woken because it was closed
+      bool timed = false;                ///< is a fiber waiting with an @ref alarm, which may go off first?
+      bool timed_out = false;            ///< set when the alarm woke us rather than whoever we were waiting on
+      timer alarm;                       ///< expires a timed wait
+
+      /// @brief Resume the waiter, on the current worker where that belongs to its pool, for cache warmth.
+      ///
+      /// The waiter may be gone as soon as this returns, and may not be touched afterwards.
+      void wake() noexcept;
+
+      /// Take the right to wake us from our alarm, if any. False if it has already gone off, and will wake us itself.
+      bool claim() noexcept { return !timed || alarm.cancel(); }
+    };
+
+    /// @brief first in, first out
+    ///
+    /// Popping skips waiters whose timed wait has already expired, and leaves them to the alarm that woke them.
+    struct wait_queue {
+      bool empty() const noexcept { return head == nullptr; }
+
+      void push(waiter * w) noexcept {
+        w->next = nullptr;
+        if (tail) tail->next = w;
+        else head = w;
+        tail = w;
+      }
+
+      waiter * pop() noexcept {
+        for (;;) {
+          waiter * w = head;
+          if (w == nullptr) return nullptr;
+          head = w->next;
+          if (head == nullptr) tail = nullptr;
+          if (w->claim()) return w;
+        }
+      }
+
+      /// take everybody, linked through @ref waiter::next
+      waiter * pop_all() noexcept {
+        waiter * first = nullptr, * last = nullptr;
+        while (waiter * w = pop()) {
+          w->next = nullptr;
+          if (last) last->next = w;
+          else first = w;
+          last = w;
+        }
+        return first;
+      }
+
+      /// take @p w out of line. false if it wasn't in it
+      bool remove(waiter * w) noexcept {
+        waiter * prev = nullptr;
+        for (waiter * i = head; i != nullptr; prev = i, i = i->next) {
+          if (i != w) continue;
+          if (prev) prev->next = w->next;
+          else head = w->next;
+          if (tail == w) tail = prev;
+          return true;
+        }
+        return false;
+      }
+
+    private:
+      waiter * head = nullptr;
+      waiter * tail = nullptr;
+    };
+
+    /// @brief Queue @p w on @p q, release @p lock, and wait for somebody to @ref waiter::wake us.
+    ///
+    /// @p lock must be held on entry, and is not held on return. Suspends the current fiber on a worker,
+    /// and blocks the thread elsewhere.
+    void block(waiter & w, wait_queue & q, spinlock & lock);
+
+    /// @brief @ref block, giving up at @p deadline, when @p w is taken back out of @p q.
+    ///
+    /// True if we were woken, false if we timed out. Fibers are timed on their worker's timing wheel.
+    bool block_until(waiter & w, wait_queue & q, spinlock & lock, chrono::clock::time_point deadline);
+
+    /// the deadline @p delay from now
+    template <typename Rep, typename Period> chrono::clock::time_point after(const std::chrono::duration<Rep, Period> & delay) {
+      return chrono::clock::now() + chrono::ceil<chrono::clock::duration>(delay);
+    }
+
+    /// wake everyone in the chain starting at @p w
+    inline void wake_all(waiter * w) noexcept {
+      while (w) {
+        waiter * next = w->next;
+        w->wake();
+        w = next;
+      }
+    }
+  }
+
+  /// @brief A mutex that suspends the fiber that is waiting for it, rather than the worker.
+  ///
+  /// Ownership is handed directly to the longest waiter on @ref unlock, so waiters are served in order.
+  /// Meets the standard @p Lockable requirements, and works from threads outside of a pool as well.
+  struct mutex {
+    mutex() = default;
+
+    /// @cond PRIVATE
+    mutex(const mutex &) = delete;
+    mutex & operator = (const mutex &) = delete;
+    /// @endcond
+
+    void lock();
+    bool try_lock() noexcept;
+    void unlock() noexcept;
+
+    /// Take the lock, waiting for it until @p deadline at most. True if we got it.
+    bool try_lock_until(chrono::clock::time_point deadline);
+
+    /// Take the lock, waiting for it for @p delay at most. True if we got it.
+    template <typename Rep, typename Period> bool try_lock_for(const std::chrono::duration<Rep, Period> & delay) {
+      return try_lock_until(detail::after(delay));
+    }
+
+  private:
+    detail::spinlock guard;
+    detail::wait_queue waiters;
+    bool locked = false;
+  };
+
+  /// @brief A condition variable for use with @ref fib::mutex, or any other @p BasicLockable.
+  ///
+  /// Waiters are woken in order. A notification never goes to a waiter that has already timed out.
+  struct condition_variable {
+    condition_variable() = default;
+
+    /// @cond PRIVATE
+    condition_variable(const condition_variable &) = delete;
+    condition_variable & operator = (const condition_variable &) = delete;
+    /// @endcond
+
+    /// Release @p lock, wait to be notified, and take @p lock again.
+    template <typename Lock> void wait(Lock & lock) {
+      detail::waiter w;
+      guard.lock();
+      // we're as good as queued while we hold the guard, so no notification can slip past us
+      lock.unlock();
+      detail::block(w, waiters, guard);
+      lock.lock();
+    }
+
+    /// Wait until @p pred holds.
+    template <typename Lock, typename Predicate> void wait(Lock & lock, Predicate pred) {
+      while (!pred()) wait(lock);
+    }
+
+    /// Release @p lock, wait to be notified or for @p deadline to pass, and take @p lock again.
+    template <typename Lock> std::cv_status wait_until(Lock & lock, chrono::clock::time_point deadline) {
+      detail::waiter w;
+      guard.lock();
+      lock.unlock();
+      bool woken = detail::block_until(w, waiters, guard, deadline);
+      lock.lock();
+      return woken ? std::cv_status::no_timeout : std::cv_status::timeout;
+    }
+
+    /// Wait until @p pred holds or @p deadline passes, and say whether @p pred holds.
+    template <typename Lock, typename Predicate> bool wait_until(Lock & lock, chrono::clock::time_point deadline, Predicate pred) {
+      while (!pred())
+        if (wait_until(lock, deadline) == std::cv_status::timeout) return pred();
+      return true;
+    }
+
+    /// Release @p lock, wait to be notified or for @p delay to pass, and take @p lock again.
+    template <typename Lock, typename Rep, typename Period> std::cv_status wait_for(Lock & lock, const std::chrono::duration<Rep, Period> & delay) {
+      return wait_until(lock, detail::after(delay));
+    }
+
+    /// Wait until @p pred holds, for @p delay at most, and say whether it does.
+    template <typename Lock, typename Rep, typename Period, typename Predicate> bool wait_for(Lock & lock, const std::chrono::duration<Rep, Period> & delay, Predicate pred) {
+      return wait_until(lock, detail::after(delay), std::move(pred));
+    }
+
+    void notify_one() noexcept;
+    void notify_all() noexcept;
+
+  private:
+    detail::spinlock guard;
+    detail::wait_queue waiters;
+  };
+
+  /// @brief A counting semaphore.
+  struct semaphore {
+    explicit semaphore(std::ptrdiff_t count = 0) noexcept : count(count) {}
+
+    /// @cond PRIVATE
+    semaphore(const semaphore &) = delete;
+    semaphore & operator = (const semaphore &) = delete;
+    /// @endcond
+
+    /// Take a unit, waiting for one if there are none.
+    void acquire();
+    bool try_acquire() noexcept;
+
+    /// Take a unit, waiting for one until @p deadline at most. True if we got one.
+    bool try_acquire_until(chrono::clock::time_point deadline);
+
+    /// Take a unit, waiting for one for @p delay at most. True if we got one.
+    template <typename Rep, typename Period> bool try_acquire_for(const std::chrono::duration<Rep, Period> & delay) {
+      return try_acquire_until(detail::after(delay));
+    }
+
+    /// Put back @p n units, handing them straight to waiters first.
+    void release(std::ptrdiff_t n = 1) noexcept;
+
+  private:
+    detail::spinlock guard;
+    detail::wait_queue waiters;
+    std::ptrdiff_t count;
+  };
+
+  /// @brief A single use countdown. Everybody waiting is released when it reaches zero.
+  struct latch {
+    explicit latch(std::ptrdiff_t count) noexcept : count(count) {}
+
+    /// @cond PRIVATE
+    latch(const latch &) = delete;
+    latch & operator = (const latch &) = delete;
+    /// @endcond
+
+    void count_down(std::ptrdiff_t n = 1) noexcept;
+    bool try_wait() const noexcept;
+    void wait();
+
+    /// Wait for zero until @p deadline at most. True if we got there.
+    bool wait_until(chrono::clock::time_point deadline);
+
+    /// Wait for zero for @p delay at most. True if we got there.
+    template <typename Rep, typename Period> bool wait_for(const std::chrono::duration<Rep, Period> & delay) {
+      return wait_until(detail::after(delay));
+    }
+
+    void arrive_and_wait(std::ptrdiff_t n = 1);
+
+  private:
+    mutable detail::spinlock guard;
+    detail::wait_queue waiters;
+    std::ptrdiff_t count;
+  };
+
+  /// @brief A reusable rendezvous for a fixed number of participants.
+  struct barrier {
+    explicit barrier(std::ptrdiff_t participants) noexcept : participants(participants), arrived(0) {}
+
+    /// @cond PRIVATE
+    barrier(const barrier &) = delete;
+    barrier & operator = (const barrier &) = delete;
+    /// @endcond
+
+    /// Wait for everyone else to arrive too. Returns true to exactly one participant in each phase.
+    bool arrive_and_wait();
+
+  private:
+    detail::spinlock guard;
+    detail::wait_queue waiters;
+    std::ptrdiff_t participants;
+    std::ptrdiff_t arrived;
+  };
+}
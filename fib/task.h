@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "memory/aligned_allocator.h"
+#include "memory/arena.h"
+
+/// @file task.h
+/// @brief @ref fib::task and @ref fib::priority
+
+namespace fib {
+
+  struct worker;
+
+  /// @brief How urgently a task should run.
+  ///
+  /// Workers run the most urgent work they have first and deal it out first, but every so often give a
+  /// starved lower class a turn, so background work still makes progress under sustained load.
+  enum class priority : int {
+    high = 0,   ///< latency critical, e.g. request handlers
+    normal = 1, ///< the default
+    low = 2     ///< background work, e.g. compaction
+  };
+
+  /// The number of distinct @ref priority levels.
+  static const int priority_levels = 3;
+
+  /// @brief Where a task would rather run.
+  ///
+  /// A hint, honoured softly: the task is routed to a worker that matches and kept there while it waits, but an
+  /// otherwise idle worker will still take it rather than let it sit.
+  struct affinity {
+    enum kind_type : int {
+      anywhere, ///< no preference
+      worker,   ///< the worker with id @ref value, modulo the number of active workers
+      node,     ///< any worker on NUMA node @ref value, modulo the number of nodes
+      key       ///< the worker @ref value picks, so tasks with equal keys share a worker. hash structured keys first
+    };
+
+    kind_type kind;
+    std::size_t value;
+
+    affinity() noexcept : kind(anywhere), value(0) {}
+    affinity(kind_type kind, std::size_t value) noexcept : kind(kind), value(value) {}
+
+    static affinity on_worker(int id) noexcept { return affinity(worker, std::size_t(id)); }
+    static affinity on_node(int n) noexcept { return affinity(node, std::size_t(n)); }
+    static affinity for_key(std::size_t k) noexcept { return affinity(key, k); }
+  };
+
+  namespace detail {
+    struct cancel_state;
+    /// drop a reference to a cancellation token. see @ref cancellation
+    void release(cancel_state * s) noexcept;
+
+    /// @brief type-erased storage for a @ref task
+    ///
+    /// Allocated from the spawning worker's @ref memory::arena where there is one, and from the aligned heap otherwise.
+    struct task_node {
+      memory::arena * origin; ///< the arena this node was allocated from, or nullptr for the aligned heap
+      fib::priority level;    ///< which of a worker's queues this belongs in
+      std::int16_t preferred_worker; ///< the worker this would rather run on, or -1
+      std::int16_t preferred_node;   ///< the NUMA node this would rather run on, or -1
+      cancel_state * token;   ///< owned reference to the cancellation token this runs under, or nullptr
+      task_node * next;       ///< intrusive link, used while queued for submission to a pool
+
+      /// execute the task
+      virtual void run(worker & w) = 0;
+      /// destroy the task and return its storage to wherever it came from
+      virtual void destroy() noexcept = 0;
+
+    protected:
+      explicit task_node(memory::arena * origin = nullptr) noexcept : origin(origin), level(fib::priority::normal), preferred_worker(-1), preferred_node(-1), token(nullptr), next(nullptr) {}
+      ~task_node() { if (token) release(token); }
+    };
+
+    template <typename F> struct task_impl final : task_node {
+      F f;
+
+      template <typename G> task_impl(memory::arena * origin, G && g) : task_node(origin), f(std::forward<G>(g)) {}
+
+      void run(worker & w) override { f(w); }
+
+      void destroy() noexcept override {
+        memory::arena * a = origin;
+        this->~task_impl();
+        if (a) a->deallocate(this, sizeof(task_impl));
+        else memory::detail::deallocate_aligned_memory(this);
+      }
+
+      /// allocate a node, from @p a if it is non-null and can satisfy our alignment
+      template <typename G> static task_node * make(memory::arena * a, G && g) {
+        if (alignof(task_impl) > memory::arena::granularity) a = nullptr;
+        void * p = a ? a->allocate(sizeof(task_impl)) : memory::detail::allocate_aligned_memory(alignof(task_impl), sizeof(task_impl));
+        try {
+          return new (p) task_impl(a, std::forward<G>(g));
+        } catch (...) {
+          if (a) a->deallocate(p, sizeof(task_impl));
+          else memory::detail::deallocate_aligned_memory(p);
+          throw;
+        }
+      }
+    };
+  }
+
+  /// @brief something to do
+  ///
+  /// A move-only handle to a type-erased @p void(worker&) callable. The callable is stored in the arena of the
+  /// current worker when there is one, so spawning from inside a task stays off the global heap.
+  struct task {
+    task() noexcept : node(nullptr) {}
+    task(std::nullptr_t) noexcept : node(nullptr) {}
+    /// adopt an existing node
+    explicit task(detail::task_node * node) noexcept : node(node) {}
+
+    /// store @p f in the current worker's arena
+    template <typename F, typename = typename std::enable_if<
+      !std::is_same<typename std::decay<F>::type, task>::value && !std::is_convertible<F, detail::task_node *>::value
+    >::type>
+    task(F && f) : node(detail::task_impl<typename std::decay<F>::type>::make(memory::arena::current(), std::forward<F>(f))) {}
+
+    /// store @p f in the arena @p a
+    template <typename F> task(memory::arena & a, F && f) : node(detail::task_impl<typename std::decay<F>::type>::make(&a, std::forward<F>(f))) {}
+
+    /// store @p f in the arena @p a, or on the aligned heap if that is null
+    template <typename F> task(memory::arena * a, F && f) : node(detail::task_impl<typename std::decay<F>::type>::make(a, std::forward<F>(f))) {}
+
+    task(task && that) noexcept : node(that.node) { that.node = nullptr; }
+    task & operator = (task && that) noexcept {
+      std::swap(node, that.node);
+      return *this;
+    }
+
+    /// @cond PRIVATE
+    task(const task &) = delete;
+    task & operator = (const task &) = delete;
+    /// @endcond
+
+    ~task() { if (node) node->destroy(); }
+
+    void operator ()(worker & w) { node->run(w); }
+    explicit operator bool () const noexcept { return node != nullptr; }
+
+    /// the priority this task will be scheduled at
+    fib::priority level() const noexcept { return node->level; }
+
+    /// the underlying node, still owned by this task
+    detail::task_node * get() const noexcept { return node; }
+    /// give up ownership of the underlying node
+    detail::task_node * release() noexcept {
+      detail::task_node * result = node;
+      node = nullptr;
+      return result;
+    }
+
+  private:
+    detail::task_node * node;
+  };
+}
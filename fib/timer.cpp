@@ -0,0 +1,139 @@
+#include <new>
+
+#include "timer.h"
+
+/// @file timer.cpp
+/// @brief @ref fib::detail::timer_wheel
+
+namespace fib {
+  namespace detail {
+    /// @cond PRIVATE
+    namespace {
+      inline std::uint64_t rotate_right(std::uint64_t x, unsigned r) noexcept {
+        return r == 0 ? x : (x >> r) | (x << (64 - r));
+      }
+    }
+    /// @endcond
+
+    timer_node * timer_node::make(std::uint64_t tick, task_node * action, int refs) {
+      void * p = memory::detail::allocate_aligned_memory(alignof(timer_node), sizeof(timer_node));
+      timer_node * t = new (p) timer_node;
+      t->tick = tick;
+      t->prev = t->next = nullptr;
+      t->slot = -1;
+      t->state.store(armed, std::memory_order_relaxed);
+      t->refs.store(refs, std::memory_order_relaxed);
+      t->action = action;
+      return t;
+    }
+
+    void timer_node::release() noexcept {
+      if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+      this->~timer_node();
+      memory::detail::deallocate_aligned_memory(this);
+    }
+
+    timer_wheel::timer_wheel() noexcept : now(current_tick(chrono::clock::now())), count(0) {
+      for (auto && head : wheel) head = nullptr;
+      for (auto && bits : occupied) bits = 0;
+    }
+
+    timer_wheel::~timer_wheel() {
+      clear();
+    }
+
+    void timer_wheel::link(timer_node * t) noexcept {
+      std::uint64_t delta = t->tick - now;
+      int level = 0;
+      while (level < levels - 1 && delta >= (std::uint64_t(1) << ((level + 1) * slot_bits))) ++level;
+      int shift = level * slot_bits;
+      // anything beyond the top level goes in its furthest slot, to be looked at again when that comes round
+      std::uint64_t block = delta >> ((level + 1) * slot_bits) ? (now >> shift) + slots : t->tick >> shift;
+      int s = level * slots + int(block & (slots - 1));
+      t->slot = s;
+      t->prev = nullptr;
+      t->next = wheel[s];
+      if (t->next) t->next->prev = t;
+      wheel[s] = t;
+      occupied[level] |= std::uint64_t(1) << (block & (slots - 1));
+      ++count;
+    }
+
+    timer_node * timer_wheel::take(int level, int slot) noexcept {
+      timer_node *& head = wheel[level * slots + slot];
+      timer_node * result = head;
+      head = nullptr;
+      occupied[level] &= ~(std::uint64_t(1) << slot);
+      for (timer_node * t = result; t; t = t->next) {
+        t->slot = -1;
+        --count;
+      }
+      return result;
+    }
+
+    bool timer_wheel::insert(timer_node * t) noexcept {
+      if (t->tick <= now) return false;
+      link(t);
+      return true;
+    }
+
+    std::uint64_t timer_wheel::next_tick() const noexcept {
+      std::uint64_t best = UINT64_MAX;
+      for (int level = 0; level < levels; ++level) {
+        if (occupied[level] == 0) continue;
+        int shift = level * slot_bits;
+        std::uint64_t block = now >> shift;
+        unsigned position = unsigned(block & (slots - 1));
+        // the next occupied slot strictly after our position, where our own slot means a full turn from now
+        unsigned k = unsigned(__builtin_ctzll(rotate_right(occupied[level], (position + 1) & (slots - 1)))) + 1;
+        std::uint64_t t = (block + k) << shift;
+        if (t < best) best = t;
+      }
+      return best;
+    }
+
+    timer_node * timer_wheel::advance(std::uint64_t tick) noexcept {
+      timer_node * due = nullptr;
+      while (count != 0) {
+        std::uint64_t t = next_tick();
+        if (t > tick) break;
+        now = t;
+        // cascade, from the top down, every level whose slot boundary we just reached
+        for (int level = levels - 1; level > 0; --level) {
+          int shift = level * slot_bits;
+          if (now & ((std::uint64_t(1) << shift) - 1)) continue;
+          timer_node * n = take(level, int((now >> shift) & (slots - 1)));
+          while (n) {
+            timer_node * next = n->next;
+            if (n->tick <= now) {
+              n->next = due;
+              due = n;
+            } else link(n);
+            n = next;
+          }
+        }
+        timer_node * n = take(0, int(now & (slots - 1)));
+        while (n) {
+          timer_node * next = n->next;
+          n->next = due;
+          due = n;
+          n = next;
+        }
+      }
+      if (tick > now) now = tick;
+      return due;
+    }
+
+    void timer_wheel::clear() noexcept {
+      for (int level = 0; level < levels; ++level)
+        for (int slot = 0; slot < slots; ++slot)
+          for (timer_node * t = take(level, slot); t;) {
+            timer_node * next = t->next;
+            int expected = timer_node::armed;
+            if (t->state.compare_exchange_strong(expected, timer_node::cancelled, std::memory_order_acq_rel)) t->action->destroy();
+            t->release();
+            t = next;
+          }
+    }
+  }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "chrono.h"
+#include "memory/aligned_allocator.h"
+#include "task.h"
+
+/// @file timer.h
+/// @brief @ref fib::timer and the per-worker timing wheel behind it
+
+namespace fib {
+  namespace detail {
+    /// an entry in a @ref timer_wheel
+    struct timer_node {
+      enum : int { armed, fired, cancelled };
+
+      std::uint64_t tick;       ///< when to fire, in wheel ticks
+      timer_node * prev;        ///< links within a wheel slot
+      timer_node * next;
+      int slot;                 ///< index of the wheel slot we're linked into
+      std::atomic<int> state;   ///< armed, fired or cancelled. whoever moves it out of armed owns the action
+      std::atomic<int> refs;    ///< the wheel holds one reference, and a @ref timer handle may hold another
+      task_node * action;       ///< scheduled on the owning worker when we fire
+
+      /// @brief allocate a timer for @p action, due at @p tick.
+      ///
+      /// From the aligned heap rather than a worker's arena, as a @ref timer handle may outlive the pool.
+      static timer_node * make(std::uint64_t tick, task_node * action, int refs);
+      /// drop a reference, freeing the node along with the last one
+      void release() noexcept;
+    };
+
+    /// @brief A hierarchical timing wheel, owned by a single worker.
+    ///
+    /// Four levels of 64 slots with 1024ns ticks reach about 17 seconds. Anything further out waits in the top
+    /// level and is re-filed as that comes around. Insertion is O(1). Occupancy bitmaps let @ref advance jump
+    /// straight to the next slot with anything in it, so an idle wheel costs nothing to keep up to date.
+    ///
+    /// Cancellation is lazy: cancelled timers stay put until they come due, and are then simply dropped.
+    struct timer_wheel {
+      static const int levels = 4;
+      static const int slot_bits = 6;
+      static const int slots = 1 << slot_bits;
+      static const int tick_shift = 10; ///< log2 of the tick length in nanoseconds
+
+      timer_wheel() noexcept;
+      ~timer_wheel();
+
+      /// @cond PRIVATE
+      timer_wheel(const timer_wheel &) = delete;
+      timer_wheel & operator = (const timer_wheel &) = delete;
+      /// @endcond
+
+      /// File @p t. Returns false, without filing it, if it is already due.
+      bool insert(timer_node * t) noexcept;
+
+      /// Advance to @p tick, returning everything that came due, linked through @ref timer_node::next.
+      timer_node * advance(std::uint64_t tick) noexcept;
+
+      /// The earliest tick at which @ref advance might have something to return. @p UINT64_MAX if empty.
+      std::uint64_t next_tick() const noexcept;
+
+      bool empty() const noexcept { return count == 0; }
+
+      /// cancel and drop everything
+      void clear() noexcept;
+
+      /// the first tick that starts at or after @p t, which is when a timer due at @p t fires
+      static std::uint64_t deadline_tick(chrono::clock::time_point t) noexcept {
+        return (nanoseconds(t) + (1 << tick_shift) - 1) >> tick_shift;
+      }
+
+      /// the last tick to have started by @p t
+      static std::uint64_t current_tick(chrono::clock::time_point t) noexcept {
+        return nanoseconds(t) >> tick_shift;
+      }
+
+      /// the start of tick @p k
+      static chrono::clock::time_point from_tick(std::uint64_t k) noexcept {
+        return chrono::clock::time_point(std::chrono::duration_cast<chrono::clock::duration>(std::chrono::nanoseconds(k << tick_shift)));
+      }
+
+    private:
+      static std::uint64_t nanoseconds(chrono::clock::time_point t) noexcept {
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+      }
+
+      timer_node * wheel[levels * slots];
+      std::uint64_t occupied[levels];
+      std::uint64_t now;   ///< the last tick we advanced to
+      std::size_t count;   ///< number of timers filed
+
+      void link(timer_node * t) noexcept;
+      timer_node * take(int level, int slot) noexcept;
+    };
+  }
+
+  /// @brief A handle to work scheduled for later, see @ref worker::spawn_after.
+  ///
+  /// Dropping the handle does not cancel anything.
+  ///
+  /// The handle may outlive the pool that made it: it shares a node from the aligned heap, not a worker's arena,
+  /// and a pool cancels its pending timers as it shuts down. The work itself does live in an arena, so a task
+  /// taken back with @ref revoke must be run or dropped before its pool is destroyed, like any other task.
+  struct timer {
+    timer() noexcept : node(nullptr) {}
+    explicit timer(detail::timer_node * node) noexcept : node(node) {}
+    timer(timer && that) noexcept : node(that.node) { that.node = nullptr; }
+    timer & operator = (timer && that) noexcept {
+      std::swap(node, that.node);
+      return *this;
+    }
+    ~timer() { if (node) node->release(); }
+
+    /// @cond PRIVATE
+    timer(const timer &) = delete;
+    timer & operator = (const timer &) = delete;
+    /// @endcond
+
+    /// Stop the work from being scheduled. True if we got there first. Safe to call from any thread.
+    bool cancel() noexcept {
+      return bool(revoke());
+    }
+
+    /// Stop the work from being scheduled, and hand it back. Empty if it was too late. Safe to call from any thread.
+    task revoke() noexcept {
+      int expected = detail::timer_node::armed;
+      if (!node || !node->state.compare_exchange_strong(expected, detail::timer_node::cancelled, std::memory_order_acq_rel)) return task();
+      return task(node->action);
+    }
+
+    /// Is the work still waiting to be scheduled?
+    bool pending() const noexcept {
+      return node && node->state.load(std::memory_order_acquire) == detail::timer_node::armed;
+    }
+
+  private:
+    detail::timer_node * node;
+  };
+}
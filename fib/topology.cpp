@@ -0,0 +1,82 @@
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "topology.h"
+
+/// @file topology.cpp
+/// @brief sysfs based implementation of @ref fib::numa
+
+namespace fib {
+  /// @cond PRIVATE
+  namespace {
+    /// parse a cpulist such as "0-3,8,10-11"
+    std::vector<int> parse_cpulist(const std::string & s) {
+      std::vector<int> result;
+      std::istringstream in(s);
+      std::string range;
+      while (std::getline(in, range, ',')) {
+        if (range.empty() || range[0] == '\n') continue;
+        std::size_t dash = range.find('-');
+        int lo = std::stoi(range.substr(0, dash));
+        int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+        for (int c = lo; c <= hi; ++c) result.push_back(c);
+      }
+      return result;
+    }
+
+    topology detect() noexcept {
+      topology t;
+      t.nodes = 0;
+      try {
+#ifdef __linux__
+        // node numbers may have holes, so give up only after a run of missing ones
+        for (int n = 0, missing = 0; missing < 64; ++n) {
+          std::ifstream f("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+          std::string line;
+          if (!f || !std::getline(f, line)) { ++missing; continue; }
+          missing = 0;
+          std::vector<int> cpus = parse_cpulist(line);
+          if (cpus.empty()) continue; // memory only
+          t.cpus.push_back(cpus);
+          ++t.nodes;
+        }
+#endif
+      } catch (...) {
+        t.cpus.clear();
+        t.nodes = 0;
+      }
+      if (t.nodes == 0) {
+        t.nodes = 1;
+        t.cpus.assign(1, std::vector<int>());
+        int n = int(std::thread::hardware_concurrency());
+        for (int c = 0; c < (n > 0 ? n : 1); ++c) t.cpus[0].push_back(c);
+      }
+      return t;
+    }
+  }
+  /// @endcond
+
+  const topology & numa() noexcept {
+    static const topology t = detect();
+    return t;
+  }
+
+  void detail::bind_to_node(int node) noexcept {
+    const topology & t = numa();
+    if (t.nodes < 2 || node < 0 || node >= t.nodes) return;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : t.cpus[node])
+      if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // a hint: on failure we just run anywhere
+#endif
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+/// @file topology.h
+/// @brief which processors share a NUMA node
+
+namespace fib {
+  /// @brief The NUMA layout of the machine.
+  ///
+  /// Read once from sysfs on Linux. Everywhere else, and whenever that fails, the machine is one node holding every processor.
+  struct topology {
+    int nodes;                          ///< how many nodes have processors on them
+    std::vector<std::vector<int>> cpus; ///< the processors of each node, in ascending order
+  };
+
+  /// The layout of the machine we are running on.
+  const topology & numa() noexcept;
+
+  namespace detail {
+    /// Restrict the calling thread to the processors of @p node. Does nothing on a single node machine.
+    void bind_to_node(int node) noexcept;
+  }
+}
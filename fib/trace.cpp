@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "chrono.h"
+#include "trace.h"
+
+/// @file trace.cpp
+/// @brief per-thread ring buffers behind @ref fib::trace, and conversion to Chrome trace JSON
+
+namespace fib {
+  namespace trace {
+    /// @cond PRIVATE
+    namespace {
+#ifdef FIB_TRACE
+      const char * const names[] = { "task", "idle", "park", "enumerator", "deal", "drain", "suspend", "resume" };
+
+      static_assert((FIB_TRACE_CAPACITY & (FIB_TRACE_CAPACITY - 1)) == 0, "FIB_TRACE_CAPACITY must be a power of two");
+
+      enum phase : std::uint8_t { slice_begin, slice_end, point };
+
+      struct event {
+        std::uint64_t stamp; ///< time stamp counter ticks, or steady clock nanoseconds without one
+        std::int32_t arg;
+        what w;
+        phase ph;
+      };
+
+      /// written only by its own thread, read by whoever dumps
+      struct ring {
+        std::atomic<std::uint64_t> head; ///< events ever written
+        std::string name;                ///< guarded by the registry lock
+        event events[FIB_TRACE_CAPACITY];
+        ring() { head.store(0, std::memory_order_relaxed); }
+      };
+
+      /// every ring ever made. rings outlive their threads, so a pool's workers can be dumped after they exit
+      std::mutex registry_lock;
+      std::vector<std::unique_ptr<ring>> & registry() {
+        static std::vector<std::unique_ptr<ring>> rings;
+        return rings;
+      }
+
+      thread_local ring * local = nullptr;
+
+      ring * attach() {
+        std::unique_ptr<ring> r(new ring);
+        std::lock_guard<std::mutex> guard(registry_lock);
+        r->name = "thread " + std::to_string(registry().size());
+        registry().push_back(std::move(r));
+        return local = registry().back().get();
+      }
+
+      inline std::uint64_t stamp() noexcept {
+#ifdef FIB_TSC
+        if (chrono::detail::tsc().usable) return chrono::detail::rdtsc();
+#endif
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+      }
+
+      inline std::int64_t nanoseconds(std::uint64_t s) noexcept {
+#ifdef FIB_TSC
+        if (chrono::detail::tsc().usable) return chrono::tsc_clock::from_ticks(s).time_since_epoch().count();
+#endif
+        return std::int64_t(s);
+      }
+
+      void record(what w, phase ph, std::int32_t arg) noexcept {
+        ring * r = local;
+        if (r == nullptr) {
+          try {
+            r = attach();
+          } catch (...) {
+            return; // out of memory: drop it
+          }
+        }
+        std::uint64_t i = r->head.load(std::memory_order_relaxed);
+        event & e = r->events[i & (FIB_TRACE_CAPACITY - 1)];
+        e.stamp = stamp();
+        e.arg = arg;
+        e.w = w;
+        e.ph = ph;
+        r->head.store(i + 1, std::memory_order_release);
+      }
+#endif
+    }
+    /// @endcond
+
+#ifdef FIB_TRACE
+    void begin(what w, std::int32_t arg) noexcept { record(w, slice_begin, arg); }
+    void end(what w) noexcept { record(w, slice_end, 0); }
+    void instant(what w, std::int32_t arg) noexcept { record(w, point, arg); }
+
+    void name_thread(const std::string & name) {
+      if (local == nullptr) attach();
+      std::lock_guard<std::mutex> guard(registry_lock);
+      local->name = name;
+    }
+#endif
+
+    void dump(std::ostream & out) {
+      out << "{\"traceEvents\":[";
+#ifdef FIB_TRACE
+      std::lock_guard<std::mutex> guard(registry_lock);
+      std::vector<std::unique_ptr<ring>> & rings = registry();
+      // snapshot each ring, then drop anything its owner may have overwritten while we copied
+      std::vector<std::vector<event>> snapshots(rings.size());
+      std::int64_t origin = std::numeric_limits<std::int64_t>::max();
+      for (std::size_t t = 0; t < rings.size(); ++t) {
+        ring & r = *rings[t];
+        std::uint64_t last = r.head.load(std::memory_order_acquire);
+        std::uint64_t first = last > FIB_TRACE_CAPACITY ? last - FIB_TRACE_CAPACITY : 0;
+        std::vector<event> & s = snapshots[t];
+        for (std::uint64_t i = first; i < last; ++i) s.push_back(r.events[i & (FIB_TRACE_CAPACITY - 1)]);
+        std::uint64_t now = r.head.load(std::memory_order_acquire);
+        // the writer may be partway through event now, which shares a slot with now - FIB_TRACE_CAPACITY
+        std::uint64_t safe = now >= FIB_TRACE_CAPACITY ? now - FIB_TRACE_CAPACITY + 1 : 0;
+        if (safe > first) s.erase(s.begin(), s.begin() + std::ptrdiff_t(std::min(safe, last) - first));
+        if (!s.empty()) origin = std::min(origin, nanoseconds(s.front().stamp));
+      }
+      bool comma = false;
+      for (std::size_t t = 0; t < rings.size(); ++t) {
+        if (comma) out << ',';
+        comma = true;
+        out << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"args\":{\"name\":\"" << rings[t]->name << "\"}}";
+        for (const event & e : snapshots[t]) {
+          std::int64_t ns = std::max(nanoseconds(e.stamp) - origin, std::int64_t(0));
+          out << ",\n{\"name\":\"" << names[int(e.w)] << "\",\"ph\":\"" << (e.ph == slice_begin ? 'B' : e.ph == slice_end ? 'E' : 'i')
+              << "\",\"pid\":1,\"tid\":" << t << ",\"ts\":" << ns / 1000 << '.' << char('0' + ns / 100 % 10) << char('0' + ns / 10 % 10) << char('0' + ns % 10);
+          if (e.ph == point) out << ",\"s\":\"t\"";
+          if (e.ph != slice_end) out << ",\"args\":{\"arg\":" << e.arg << '}';
+          out << '}';
+        }
+      }
+#endif
+      out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+
+    bool dump(const std::string & path) {
+      std::ofstream out(path);
+      if (!out) return false;
+      dump(out);
+      return bool(out);
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+/// @file trace.h
+/// @brief @ref fib::trace, a timeline of worker and fiber activity
+
+/// @def FIB_TRACE
+/// @brief define to compile the @ref fib::trace hooks in. Without it they are empty inline functions.
+
+/// @def FIB_TRACE_CAPACITY
+/// @brief how many events each thread keeps before overwriting its oldest. A power of two.
+#ifndef FIB_TRACE_CAPACITY
+#define FIB_TRACE_CAPACITY 65536
+#endif
+
+namespace fib {
+  /// @brief A timeline of what each thread was doing, for chrome://tracing or Perfetto.
+  ///
+  /// Each thread records into a lock-free ring buffer of its own, stamped with the time stamp counter where we
+  /// have one, so an event costs a few nanoseconds and never contends. @ref dump converts what the rings still hold
+  /// into Chrome trace event JSON, and can be called at any time. A pool also dumps to the file named by the
+  /// @p FIB_TRACE_FILE environment variable as it shuts down.
+  namespace trace {
+    /// what a thread was up to
+    enum class what : std::uint8_t {
+      task,       ///< running a task, at the priority in the argument. a slice
+      idle,       ///< out of work and looking for more. a slice
+      park,       ///< asleep, waiting to be woken with work. a slice
+      enumerator, ///< running an @ref enumerator's fiber to get its next element. a slice
+      deal,       ///< dealt a task to the worker in the argument
+      drain,      ///< took submitted tasks from the inbox in the argument
+      suspend,    ///< the task being run suspended its fiber
+      resume      ///< switched to a suspended fiber
+    };
+
+#ifdef FIB_TRACE
+    /// start a slice
+    void begin(what w, std::int32_t arg = 0) noexcept;
+    /// finish the innermost slice
+    void end(what w) noexcept;
+    /// record a point in time
+    void instant(what w, std::int32_t arg = 0) noexcept;
+    /// label the calling thread in the timeline
+    void name_thread(const std::string & name);
+#else
+    inline void begin(what, std::int32_t = 0) noexcept {}
+    inline void end(what) noexcept {}
+    inline void instant(what, std::int32_t = 0) noexcept {}
+    inline void name_thread(const std::string &) {}
+#endif
+
+    /// @brief a slice lasting as long as this does
+    struct span {
+      explicit span(what w, std::int32_t arg = 0) noexcept : w(w) { begin(w, arg); }
+      ~span() { end(w); }
+
+      /// @cond PRIVATE
+      span(const span &) = delete;
+      span & operator = (const span &) = delete;
+      /// @endcond
+    private:
+      what w;
+    };
+
+    /// Write every event still held as Chrome trace event JSON. Safe to call while threads are recording.
+    void dump(std::ostream & out);
+
+    /// Write the trace to the file at @p path. false if it couldn't be written.
+    bool dump(const std::string & path);
+  }
+}
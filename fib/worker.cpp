@@ -1,10 +1,18 @@
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <exception>
+#include <mutex>
 #include <random>
 #include <ratio>
 
 #include "chrono.h"
+#include "fiber.h"
+#include "timer.h"
+#include "topology.h"
+#include "trace.h"
 #include "worker.h"
 
 namespace fib {
@@ -14,71 +22,499 @@ namespace fib {
        flawed and we don't share enough. Currently 0.1ms */
   static const double expected_task_duration = 100.0;
 
+  /// how many times an idle worker yields before parking
+  static const int park_after = 256;
+
+  /// @brief how many times an idle worker looks for work before draining other workers' inboxes.
+  ///
+  /// Tasks routed to a particular worker wait in its inbox, so this gives the owner a moment to get to them first.
+  static const int steal_patience = 16;
+
+  /// how far into a queue a deal looks for a task that doesn't mind leaving
+  static const std::size_t deal_window = 4;
+
+  /// @brief how long a parked worker sleeps before looking around again.
+  ///
+  /// Wakeups are explicit; this only bounds the damage should one ever go astray.
+  static const std::chrono::milliseconds park_timeout(10);
+
+  /// @cond PRIVATE
+  namespace {
+    thread_local worker * current_worker = nullptr;
+  }
+  /// @endcond
+
+  // never inlined: a fiber may resume on another thread, so the thread local must be looked up afresh
+  worker * worker::current() noexcept {
+    return current_worker;
+  }
+
+  task worker::take() {
+    while (!empty()) {
+      int pick = -1;
+      for (int c = 0; c < priority_levels; ++c) {
+        if (q[c].empty()) continue;
+        if (pick < 0) pick = c;
+        else if (++passed[c] > starvation_limit) { // starved, so it jumps the line
+          pick = c;
+          break;
+        }
+      }
+      passed[pick] = 0;
+      task t = std::move(q[pick].back());
+      q[pick].pop_back();
+      if (!detail::dead(t.get())) return t;
+      // cancelled: drop it unrun, and look again
+    }
+    return task();
+  }
+
+  bool worker::drain(int i) {
+    if (p.inbox[i].data.load(std::memory_order_relaxed) == nullptr) return false;
+    detail::task_node * n = p.inbox[i].data.exchange(nullptr, std::memory_order_acquire);
+    if (n == nullptr) return false;
+    // newest first, so the oldest submission ends up on the back of the deque, where we run from
+    while (n != nullptr) {
+      detail::task_node * next = n->next;
+      n->next = nullptr;
+      q[int(n->level)].push_back(task(n));
+      n = next;
+    }
+    trace::instant(trace::what::drain, i);
+    return true;
+  }
+
+  bool worker::drain() {
+    for (int k = 0; k < p.N; ++k)
+      if (drain((id + k) % p.N)) return true;
+    return false;
+  }
+
+  void worker::park(chrono::clock::duration timeout) {
+    trace::span parked(trace::what::park);
+    std::unique_lock<std::mutex> lock(parking);
+    sleeping.store(true, std::memory_order_seq_cst);
+    // now that wakers can see we're asleep, make sure nothing arrived in the meantime
+    bool idle = p.s[id].data.load(std::memory_order_seq_cst) == nullptr && !p.shutdown.load(std::memory_order_seq_cst);
+    for (int i = 0; idle && i < p.N; ++i)
+      idle = p.inbox[i].data.load(std::memory_order_seq_cst) == nullptr;
+    if (idle) wakeup.wait_for(lock, timeout, [this] { return !sleeping.load(std::memory_order_relaxed); });
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+
+  void worker::retire() {
+    detail::task_node * tp = p.s[id].data.exchange(&detail::dummy_task::instance, std::memory_order_acquire);
+    if (tp != nullptr && tp != &detail::dummy_task::instance) q[int(tp->level)].push_back(task(tp));
+    drain(id);
+    chrono::clock::time_point now = chrono::clock::now();
+    if (!timers.empty()) expire(now);
+    hand_off();
+    backlog.store(0, std::memory_order_relaxed);
+    // sleep until called back or shut down, waking for our timers as they come due
+    chrono::clock::duration timeout = park_timeout;
+    if (!timers.empty()) {
+      chrono::clock::duration until = detail::timer_wheel::from_tick(timers.next_tick()) - now;
+      if (until < timeout) timeout = until > chrono::clock::duration::zero() ? until : chrono::clock::duration::zero();
+    }
+    trace::span parked(trace::what::park);
+    std::unique_lock<std::mutex> lock(parking);
+    sleeping.store(true, std::memory_order_seq_cst);
+    bool idle = id >= p.active() && !p.shutdown.load(std::memory_order_seq_cst) && p.inbox[id].data.load(std::memory_order_seq_cst) == nullptr;
+    if (idle) wakeup.wait_for(lock, timeout, [this] { return !sleeping.load(std::memory_order_relaxed); });
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+
+  void worker::hand_off() {
+    if (empty()) return;
+    // one chain, oldest first, so it lands in the same order it left
+    detail::task_node * head = nullptr, * tail = nullptr;
+    for (int c = 0; c < priority_levels; ++c) {
+      for (auto && t : q[c]) {
+        detail::task_node * n = t.release();
+        n->next = nullptr;
+        if (tail) tail->next = n;
+        else head = n;
+        tail = n;
+      }
+      q[c].clear();
+    }
+    p.inject_to(id % p.active(), head, tail);
+  }
+
+  void worker::wake() {
+    // order whatever work we just published before checking whether anybody needs telling about it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!sleeping.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lock(parking);
+    sleeping.store(false, std::memory_order_relaxed);
+    wakeup.notify_one();
+  }
+
+  bool worker::fire(detail::timer_node * n) {
+    int expected = detail::timer_node::armed;
+    bool fired = n->state.compare_exchange_strong(expected, detail::timer_node::fired, std::memory_order_acq_rel);
+    if (fired) schedule(task(n->action));
+    n->release();
+    return fired;
+  }
+
+  bool worker::expire(chrono::clock::time_point now) {
+    bool fired = false;
+    for (detail::timer_node * n = timers.advance(detail::timer_wheel::current_tick(now)); n != nullptr;) {
+      detail::timer_node * next = n->next;
+      fired |= fire(n);
+      n = next;
+    }
+    return fired;
+  }
+
+  timer worker::schedule_at(chrono::clock::time_point deadline, task t) {
+    // one reference for the wheel, one for the handle
+    detail::timer_node * n = detail::timer_node::make(detail::timer_wheel::deadline_tick(deadline), t.get(), 2);
+    t.release();
+    if (!timers.insert(n)) fire(n); // already due
+    return timer(n);
+  }
+
+  task worker::acquire() {
+    trace::span unemployed(trace::what::idle);
+    // keep idle_time current while we wait, so the autoscaler sees long idle spells as they happen
+    struct idle_clock {
+      std::atomic<std::uint64_t> & total;
+      chrono::clock::time_point mark;
+      void tick() noexcept {
+        chrono::clock::time_point now = chrono::clock::now();
+        total.store(total.load(std::memory_order_relaxed) + std::uint64_t((now - mark).count()), std::memory_order_relaxed);
+        mark = now;
+      }
+      ~idle_clock() { tick(); }
+    } idle { idle_time, chrono::clock::now() };
+    p.s[id].data.store(nullptr, std::memory_order_seq_cst);
+    // TODO: introduce exponential backoff here
+    for (int spins = 0;; ++spins) {
+      idle.tick();
+      detail::task_node * tp = p.s[id].data.load(std::memory_order_acquire);
+      if (tp != nullptr) {
+        task t(tp); // dealt tasks are handed over unboxed, and freed back to the arena of whoever spawned them
+        if (detail::dead(tp)) {
+          // cancelled in transit: drop it, and keep asking
+          p.s[id].data.store(nullptr, std::memory_order_seq_cst);
+          continue;
+        }
+        // employed
+        p.s[id].data.store(&detail::dummy_task::instance, std::memory_order_relaxed);
+        return t;
+      }
+      if (p.shutdown.load(std::memory_order_relaxed)) return task(); // check for pool shutdown
+      if (id >= p.active()) {
+        // retired: stop asking, and keep anything dealt to us in the meantime to hand off
+        tp = p.s[id].data.exchange(&detail::dummy_task::instance, std::memory_order_acquire);
+        if (tp != nullptr) q[int(tp->level)].push_back(task(tp));
+        return task();
+      }
+      chrono::clock::time_point now;
+      if (!timers.empty()) now = chrono::clock::now();
+      if (drain(id) || (spins >= steal_patience && drain()) || (!timers.empty() && expire(now))) {
+        // withdraw our request for work, keeping anything a peer managed to deal us in the meantime
+        tp = p.s[id].data.exchange(&detail::dummy_task::instance, std::memory_order_acquire);
+        if (tp != nullptr) q[int(tp->level)].push_back(task(tp));
+        task t = take();
+        if (t) return t;
+        // everything we found had been cancelled
+        p.s[id].data.store(nullptr, std::memory_order_seq_cst);
+        continue;
+      }
+      // unemployed
+      if (spins < park_after) std::this_thread::yield();
+      else if (timers.empty()) park(park_timeout);
+      else {
+        // don't sleep through our next timer
+        chrono::clock::duration until = detail::timer_wheel::from_tick(timers.next_tick()) - now;
+        if (until > chrono::clock::duration::zero()) park(until < park_timeout ? until : chrono::clock::duration(park_timeout));
+      }
+    }
+  }
+
   void worker::run() {
 // #ifdef FIB_SUPPORTS_CDS
 //    cds_thread_attachment attach_thread;
 // #endif
+    memory::arena::scope bind(arena); // tasks spawned and memory allocated while we run come from our arena
+    current_worker = this;
+    detail::bind_to_node(node);
+    trace::name_thread("worker " + std::to_string(id));
+    // std::exponential_distribution used to take expected_task_duration as its rate, so this is the mean we have been running with
+    deal_delay = fib::chrono::floor<chrono::clock::duration>(std::chrono::duration<double, std::micro>(1 / expected_task_duration));
+    deal_deadline = chrono::clock::now();
+    // the scheduler runs on a fiber, and comes back here with whichever one it is on when we shut down
+    running = fresh_fiber();
+    boost::context::detail::transfer_t last = boost::context::detail::jump_fcontext(running->context, nullptr);
+    p.free_fiber(static_cast<detail::fiber *>(last.data));
+    for (auto && f : spare) p.free_fiber(f);
+    spare.clear();
+    current_worker = nullptr;
+  } // worker::run
 
-    std::uniform_int_distribution<int> random_peer(0, p.N - 2);
-    std::exponential_distribution<double> random_delay_us(expected_task_duration);
-    auto d = std::chrono::high_resolution_clock::now();
-    for (;;) {
-      task t;
-      if (p.shutdown.load(std::memory_order_relaxed)) return; // check for pool shutdown
-      if (q.empty()) {
-        // acquire
-        p.s[id].data.store(nullptr, std::memory_order_relaxed);
-        // TODO: introduce exponential backoff here
-        task * tp = p.s[id].data.load(std::memory_order_relaxed);
-        while (t == nullptr) {
-          // unemployed
-          std::this_thread::yield();
-          if (p.shutdown.load(std::memory_order_relaxed)) return; // check for pool shutdown
-          tp = p.s[id].data.load(std::memory_order_relaxed);
-        }
-        // employed
-        t = *tp;
-        delete tp;
-      } else {
-        // have work
-        t = q.back();
-        q.pop_back();
+  void worker::loop() {
+    while (current()->step()) {}
+    worker & w = *current();
+    boost::context::detail::jump_fcontext(w.home, w.running);
+  }
+
+  bool worker::step() {
+    task t;
+    if (p.shutdown.load(std::memory_order_relaxed)) return false; // check for pool shutdown
+    int active = p.active();
+    if (id >= active) {
+      retire();
+      return true;
+    }
+    drain(id); // pick up anything submitted to our own inbox
+    // sample the clock at most once a round, for both the timers and the deal
+    chrono::clock::time_point now;
+    if (active > 1 || !timers.empty()) now = chrono::clock::now();
+    if (!timers.empty()) expire(now);
+    if (!empty()) t = take(); // have work, unless it was all cancelled
+    if (!t) {
+      t = acquire();
+      if (!t) return !p.shutdown.load(std::memory_order_relaxed); // shutdown, or retired
+    }
+    std::size_t queued = 0;
+    for (int c = 0; c < priority_levels; ++c) queued += q[c].size();
+    backlog.store(queued, std::memory_order_relaxed);
+    if (active > 1) { // we have peers, so see if we should hand off work
+      // deal out our most urgent work first
+      int c = 0;
+      while (c < priority_levels && q[c].empty()) ++c;
+      // communicate if we should deal and we have something to deal out. urgent work doesn't wait for the delay
+      bool due = now > deal_deadline;
+      if (c < priority_levels && (due || c == int(priority::high))) {
+        deal(c);
+        // don't resample time and round down to err on the side of too much sharing if tasks run long
+        if (due) deal_deadline = now + chrono::clock::duration(chrono::clock::rep(float(deal_delay.count()) * rng.exponential()));
       }
-      if (p.N > 1) { // we have peers, so see if we should hand off work
-        auto then = std::chrono::high_resolution_clock::now();
-        // communicate if we should deal and we have something to deal out
-        if (then > d && !q.empty()) {
-          // deal attempt
-          int j = random_peer(rng);
-          if (j >= id) j += 1; // make sure it isn't us. can't wrap: j < N-1 before.
-
-          task * expected = nullptr;
-          // compare_exchange_weak should be fine, we're already in an outer loop, we'll come back
-          // on excessively weak architectures, this might mean that the effective delay is much higher though
-          if (p.s[j].data.load(std::memory_order_relaxed) == nullptr
-           && p.s[j].data.compare_exchange_weak(expected, &q.front(), std::memory_order_seq_cst))
-            q.pop_front(); // we gave the front of the deque away
-            // sent work to worker j;
-
-          // don't resample time and round down to err on the side of too much sharing if tasks run long
-          d = then - fib::chrono::floor<std::chrono::high_resolution_clock::duration>(
-            std::chrono::duration<double, std::micro>(random_delay_us(rng))
-          );
+    }
+    level = t.level();
+    token = t.get()->token;
+    trace::begin(trace::what::task, int(level));
+    try {
+      // if this suspends, we may come back on another worker, so nothing below may touch our members
+      t(*this);
+      trace::end(trace::what::task);
+    } catch (...) {
+      p.shutdown.store(true, std::memory_order_release);
+      throw;
+    }
+    return true;
+  }
+
+  void worker::deal(int c) {
+    // look a little way in for a task that either wants a peer that is asking for work, or doesn't care where it runs.
+    // failing that, deal the front anyway: an idle peer beats a preference
+    std::size_t pick = 0;
+    int j = -1;
+    bool free = false;
+    std::size_t window = q[c].size() < deal_window ? q[c].size() : deal_window;
+    for (std::size_t k = 0; k < window; ++k) {
+      detail::task_node * n = q[c][k].get();
+      if (detail::dead(n)) {
+        // nobody should run this: drop it instead of dealing anything this round
+        q[c].erase(q[c].begin() + std::ptrdiff_t(k));
+        return;
+      }
+      int want = n->preferred_worker;
+      if (want < 0 && n->preferred_node >= 0 && n->preferred_node != node) want = p.resident(n->preferred_node, this);
+      if (want >= 0 && want != id) {
+        if (p.s[want].data.load(std::memory_order_relaxed) == nullptr) {
+          pick = k;
+          j = want;
+          break;
         }
+      } else if (want < 0 && n->preferred_node < 0 && !free) {
+        pick = k;
+        free = true;
+      }
+    }
+    if (j < 0) {
+      int active = p.active();
+      if (active < 2) return;
+      j = victim(active);
+    }
+
+    detail::task_node * expected = nullptr;
+    // compare_exchange_weak should be fine, we're already in an outer loop, we'll come back
+    // on excessively weak architectures, this might mean that the effective delay is much higher though
+    if (p.s[j].data.load(std::memory_order_relaxed) == nullptr
+     && p.s[j].data.compare_exchange_weak(expected, q[c][pick].get(), std::memory_order_seq_cst)) {
+      q[c][pick].release(); // we gave it away
+      q[c].erase(q[c].begin() + std::ptrdiff_t(pick));
+      // sent work to worker j, which may have gone to sleep waiting for it
+      p.workers[j]->wake();
+      trace::instant(trace::what::deal, j);
+    }
+  }
+
+  int worker::victim(int active) noexcept {
+    std::uint32_t peers = std::uint32_t(active - 1);
+    int j;
+    switch (p.victims.load(std::memory_order_relaxed)) {
+      case victim_policy::round_robin:
+        j = int(++rotation % peers);
+        break;
+      case victim_policy::power_of_two: {
+        int a = int(rng.below(peers)), b = int(rng.below(peers));
+        if (a >= id) a += 1;
+        if (b >= id) b += 1;
+        bool asking_a = p.s[a].data.load(std::memory_order_relaxed) == nullptr;
+        bool asking_b = p.s[b].data.load(std::memory_order_relaxed) == nullptr;
+        if (asking_a != asking_b) return asking_a ? a : b;
+        return p.workers[b]->backlog.load(std::memory_order_relaxed) < p.workers[a]->backlog.load(std::memory_order_relaxed) ? b : a;
+      }
+      default:
+        j = int(rng.below(peers));
+        break;
+    }
+    return j >= id ? j + 1 : j; // make sure it isn't us. can't wrap: j < active-1 before.
+  }
+
+  int pool::resident(int node, worker * from) noexcept {
+    if (node < 0 || std::size_t(node) >= residents.size()) return -1;
+    const std::vector<int> & r = residents[std::size_t(node)];
+    if (r.empty() || (from != nullptr && from->node == node)) return -1;
+    static thread_local unsigned turn = 0;
+    return r[turn++ % r.size()];
+  }
+
+  int pool::route(detail::task_node * n, const affinity & where, worker * from) noexcept {
+    int i = -1;
+    switch (where.kind) {
+      case affinity::worker:
+        i = int(where.value % std::size_t(active()));
+        break;
+      case affinity::key:
+        // plain modulus, so shard k of a table partitioned N ways gets a worker to itself
+        i = int(where.value % std::size_t(active()));
+        break;
+      case affinity::node: {
+        int node = int(where.value % std::size_t(numa().nodes));
+        if (residents[std::size_t(node)].empty()) return -1; // none of us live there
+        n->preferred_node = std::int16_t(node);
+        return resident(node, from);
       }
-      try {
-        t(*this);
-      } catch (...) {
-        p.shutdown.store(true, std::memory_order_release);
-        throw;
+      default:
+        return -1;
+    }
+    n->preferred_worker = std::int16_t(i);
+    n->preferred_node = std::int16_t(workers[i]->node);
+    return from != nullptr && from->id == i ? -1 : i;
+  }
+
+  void pool::push(int i, detail::task_node * head, detail::task_node * tail) noexcept {
+    detail::task_node * top = inbox[i].data.load(std::memory_order_relaxed);
+    do {
+      tail->next = top;
+    } while (!inbox[i].data.compare_exchange_weak(top, head, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  void pool::inject_to(int i, detail::task_node * head, detail::task_node * tail) noexcept {
+    push(i, head, tail);
+    workers[i]->wake();
+  }
+
+  void pool::inject(detail::task_node * head, detail::task_node * tail) noexcept {
+    // each submitting thread walks the inboxes round robin from its own starting point, so submitters rarely collide
+    static thread_local unsigned shard = unsigned(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    int active = this->active();
+    int i = int(shard++ % unsigned(active));
+    push(i, head, tail);
+    // any idle worker will drain any inbox, so wake whoever is asleep, starting with the inbox owner
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int k = 0; k < active; ++k) {
+      worker & w = *workers[(i + k) % active];
+      if (w.sleeping.load(std::memory_order_relaxed)) {
+        w.wake();
+        return;
       }
     }
-  } // worker::main
+  }
+
+  void pool::resize(int n) noexcept {
+    if (n < 1) n = 1;
+    if (n > N) n = N;
+    int old = active_workers.exchange(n, std::memory_order_seq_cst);
+    // wake those called back, so they start asking for work, and those retired, so they hand theirs off
+    for (int i = std::min(old, n); i < std::max(old, n); ++i)
+      workers[i]->wake();
+  }
+
+  void pool::autoscale(const scaling_policy & policy) {
+    stop_autoscaling();
+    std::lock_guard<std::mutex> lock(scaler_lock);
+    scaling = true;
+    scaler = std::thread([this, policy] { scale(policy); });
+  }
+
+  void pool::stop_autoscaling() {
+    {
+      std::lock_guard<std::mutex> lock(scaler_lock);
+      scaling = false;
+    }
+    scaler_wake.notify_all();
+    if (scaler.joinable()) scaler.join();
+  }
+
+  void pool::scale(scaling_policy policy) {
+    std::vector<std::uint64_t> seen(std::size_t(N), 0);
+    for (int i = 0; i < N; ++i) seen[i] = workers[i]->idle_time.load(std::memory_order_relaxed);
+    chrono::clock::time_point then = chrono::clock::now();
+    std::unique_lock<std::mutex> lock(scaler_lock);
+    while (!scaler_wake.wait_for(lock, policy.period, [this] { return !scaling; })) {
+      chrono::clock::time_point now = chrono::clock::now();
+      double elapsed = double((now - then).count());
+      then = now;
+      int active = this->active();
+      double idle = 0, queued = 0;
+      for (int i = 0; i < N; ++i) {
+        std::uint64_t t = workers[i]->idle_time.load(std::memory_order_relaxed);
+        if (i < active) {
+          idle += double(t - seen[i]);
+          queued += double(workers[i]->backlog.load(std::memory_order_relaxed));
+        }
+        seen[i] = t;
+      }
+      if (elapsed <= 0) continue;
+      idle /= elapsed * active;
+      queued /= active;
+      // grow only when nobody has been idling much, so we don't flap between the two
+      if (queued > policy.grow_backlog && idle < policy.shrink_idle / 2 && active < N) resize(active + 1);
+      else if (idle > policy.shrink_idle && active > policy.min_workers) resize(active - 1);
+    }
+  }
 
   pool::~pool() {
-    shutdown.store(true, std::memory_order_release);
+    stop_autoscaling();
+    shutdown.store(true, std::memory_order_seq_cst);
+    for (auto && w : workers)
+      w->wake();
     for (auto && thread : threads)
       thread.join();
+#ifdef FIB_TRACE
+    if (const char * path = std::getenv("FIB_TRACE_FILE")) trace::dump(std::string(path));
+#endif
+    // tasks may have been dealt between workers, so release them all before any arena goes away
+    for (int i = 0; i < N; ++i) {
+      detail::task_node * tp = s[i].data.load(std::memory_order_acquire);
+      if (tp != nullptr && tp != &detail::dummy_task::instance) tp->destroy();
+      for (tp = inbox[i].data.load(std::memory_order_acquire); tp != nullptr;) {
+        detail::task_node * next = tp->next;
+        tp->destroy();
+        tp = next;
+      }
+      for (auto && q : workers[i]->q) q.clear();
+      workers[i]->timers.clear();
+    }
+    // whatever fibers are left were suspended, and will never be resumed
+    while (fibers != nullptr) free_fiber(fibers);
   }
 
   detail::dummy_task detail::dummy_task::instance;
@@ -1,14 +1,34 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
+#include <iterator>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include <boost/context/detail/fcontext.hpp>
+#include <boost/context/protected_fixedsize_stack.hpp>
+
+#include "attribute.h"
+#include "cancel.h"
+#include "chrono.h"
+#include "fiber.h"
+#include "memory/arena.h"
 #include "memory/isolated.h"
+#include "random.h"
+#include "task.h"
+#include "timer.h"
+#include "topology.h"
+#include "trace.h"
 
 /// @file worker.h
 /// @brief @ref fib::worker and @ref fib::pool
@@ -18,89 +38,493 @@ namespace fib {
   struct pool;
   struct worker;
 
-  /// something to do
-  using task = std::function<void(worker&)>;
-
   /// The maximum number of workers allowed in any given pool.
   static const size_t max_workers = 16;
 
+  /// @brief What @ref worker::spawn does with the child and the caller.
+  enum class spawn_policy {
+    /// Queue the child and carry on with the caller. Cheap, but a deep recursive fork queues every
+    /// child before any of them runs.
+    help_first,
+    /// Run the child at once and queue the caller's continuation instead, where it can be dealt to an idle
+    /// peer, Cilk style. Queue depth stays at the depth of the recursion, and children run in the order
+    /// a serial execution would run them, at the price of a fiber switch per spawn.
+    work_first
+  };
+
+  /// @brief Who a worker deals work to, when no task it holds would rather go somewhere in particular.
+  ///
+  /// Only peers asking for work can take it, so these differ in how quickly a worker with work finds one that is.
+  enum class victim_policy {
+    random,      ///< a peer picked uniformly at random. the default
+    round_robin, ///< each peer in turn
+    power_of_two ///< the better of two random peers: one asking for work, or failing that the one with less queued
+  };
+
   /// @brief A member of a thread pool, replete with a local work-sharing deque.
   ///
+  /// Tasks run on fibers, so a task that blocks suspends just its fiber and the worker carries on with
+  /// something else. The suspended fiber may well be resumed by a different worker.
+  ///
   /// Never give this to another thread.
-  /// Do not remember the current worker across blocking calls.
-
-  // TODO: upgrade to support fibers
+  /// Do not remember the current worker across blocking calls: look it up again with @ref current.
   struct worker {
-    std::mt19937 rng;   ///< local random number generator to avoid having to go back to a central pool of randomness for sharing candidate selection
-    std::deque<task> q; ///< local jobs
-    pool & p;           ///< owning pool
-    int id;             ///< worker id within the pool
+    xoshiro256 rng;       ///< local random number generator to avoid having to go back to a central pool of randomness for sharing candidate selection
+    memory::arena arena;  ///< local storage for tasks spawned here, and for anything allocated via @ref memory::arena_allocator inside them
+    std::deque<task> q[priority_levels]; ///< local jobs, one queue per @ref priority
+    pool & p;             ///< owning pool
+    int id;               ///< worker id within the pool
+    int node;             ///< the NUMA node this worker's thread is bound to
+    fib::priority level;  ///< priority of the task we are currently running, inherited by whatever it spawns
+    detail::cancel_state * token; ///< cancellation token of the task we are currently running, inherited by whatever it spawns. not owned
     friend struct pool;
+    friend struct detail::fiber;
+
+    /// How many times a non-empty priority class may be passed over for a more urgent one before it gets a turn.
+    static const int starvation_limit = 32;
+
+    /// Call @p f with this worker at the priority of the current task, following the pool's @ref pool::spawning policy.
+    template <typename F> void spawn(F && f);
+
+    /// Call @p f with this worker and @p args at the priority of the current task, following the pool's @ref pool::spawning policy.
+    template <typename F, typename T, typename ... Ts> void spawn(F && f, T && arg, Ts && ... args) {
+       spawn(std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<T>(arg), std::forward<Ts>(args)...));
+    }
+
+    /// @brief Call @p f with this worker at the priority of the current task, following @p how.
+    ///
+    /// Under @ref spawn_policy::work_first the current task is suspended, its fiber queued where @ref spawn
+    /// would have queued @p f, and @p f runs at once. The caller may therefore come back on another worker.
+    template <typename F> void spawn(spawn_policy how, F && f);
+
+    /// @brief Call @p f on a worker matching @p where, at the priority of the current task. This always helps first.
+    ///
+    /// If we match, @p f is queued here as usual, and only dealt when nothing else can be. Otherwise it goes to the inbox of a worker
+    /// that does, which takes it next time round. Idle workers will take it from there too, but only once they
+    /// have found nothing else to do.
+    template <typename F> void spawn(affinity where, F && f);
+
+    /// Schedule @p f to be called with this worker at the priority of the current task, under @p c rather than the current task's token.
+    template <typename F> void spawn(cancellation c, F && f) {
+      task t(arena, std::forward<F>(f));
+      t.get()->level = level;
+      t.get()->token = detail::share(c.get());
+      q[int(level)].push_back(std::move(t));
+    }
+
+    /// Schedule @p f to be called with this worker at priority @p level. This always helps first.
+    template <typename F> void spawn(fib::priority level, F && f) {
+       task t(arena, std::forward<F>(f));
+       t.get()->level = level;
+       t.get()->token = detail::share(token);
+       q[int(level)].push_back(std::move(t));
+    }
+
+    /// Schedule @p f to be called with this worker and @p args at priority @p level.
+    template <typename F, typename T, typename ... Ts> void spawn(fib::priority level, F && f, T && arg, Ts && ... args) {
+       spawn(level, std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<T>(arg), std::forward<Ts>(args)...));
+    }
+
+    /// Schedule @p f to be called with this worker once @p deadline has passed, at the priority of the current task.
+    template <typename F> timer spawn_at(chrono::clock::time_point deadline, F && f) {
+      task t(arena, std::forward<F>(f));
+      t.get()->level = level;
+      t.get()->token = detail::share(token);
+      return schedule_at(deadline, std::move(t));
+    }
 
-    /// Schedule a @p task.
-    template <typename ... T, typename F> void spawn(F && f, T && ... args) {
-       // TODO: Should we eagerly context switch and enqueue the current fiber instead?
-       q.push_back(task(std::forward(f), std::forward(args)...));
+    /// Schedule @p f to be called with this worker after @p delay, at the priority of the current task.
+    template <typename Rep, typename Period, typename F> timer spawn_after(const std::chrono::duration<Rep, Period> & delay, F && f) {
+      return spawn_at(chrono::clock::now() + chrono::ceil<chrono::clock::duration>(delay), std::forward<F>(f));
     }
+
+    /// Queue @p t locally at its own priority, to run next.
+    void schedule(task t) {
+      fib::priority c = t.level();
+      q[int(c)].push_back(std::move(t));
+    }
+
+    /// Queue @p t locally at its own priority, behind everything already there.
+    void defer(task t) {
+      fib::priority c = t.level();
+      q[int(c)].push_front(std::move(t));
+    }
+
+    /// Queue @p t locally once @p deadline has passed. The handle may be used to cancel it.
+    timer schedule_at(chrono::clock::time_point deadline, task t);
+
+    /// @brief Suspend the current task, and hand its fiber to @p f.
+    ///
+    /// @p f is called as @p f(fiber*) on a fresh fiber of the same worker, and should arrange for the suspended fiber
+    /// to be scheduled again, e.g. with @ref schedule. It must not throw, and publishing the fiber must be the last
+    /// thing it does with it, as another worker may resume it straight away.
+    template <typename F> static void suspend(F && f) {
+      suspend_with([](void * data, detail::fiber * self) {
+        (*static_cast<typename std::remove_reference<F>::type *>(data))(self);
+      }, &f);
+    }
+
+    /// The worker running the current task, or nullptr outside of a pool.
+    static worker * current() noexcept FIB_ATTRIBUTE_NOINLINE;
+
+    /// Do we have any local work at all?
+    bool empty() const noexcept {
+      for (int c = 0; c < priority_levels; ++c)
+        if (!q[c].empty()) return false;
+      return true;
+    }
+
+    /// @cond PRIVATE
+    worker(const worker &) = delete;
+    worker & operator = (const worker &) = delete;
+    /// @endcond
   private:
     /// construct a new worker
-    template <typename SeedSeq> worker(pool &p, int id, SeedSeq & seed) : rng(seed), id(id), p(p) {}
-    /// private entry point
+    template <typename SeedSeq> worker(pool &p, int id, int node, SeedSeq & seed) : rng(seed), p(p), id(id), node(node), level(fib::priority::normal), token(nullptr), rotation(unsigned(id)), running(nullptr), home(nullptr) {
+      for (int c = 0; c < priority_levels; ++c) passed[c] = 0;
+      sleeping.store(false, std::memory_order_relaxed);
+      idle_time.store(0, std::memory_order_relaxed);
+      backlog.store(0, std::memory_order_relaxed);
+    }
+    /// private entry point. runs on the thread's own stack, and starts the scheduler on a fiber
     void run();
+    /// the scheduler. migrates from worker to worker along with the fiber it runs on, so it is static
+    static void loop();
+    /// run one round of the scheduler. false on shutdown
+    bool step();
+    /// where every fresh fiber starts
+    static void entry(boost::context::detail::transfer_t from);
+    /// type-erased @ref suspend
+    static void suspend_with(void (*callback)(void *, detail::fiber *), void * data);
+    /// a fiber ready to start the scheduler on
+    detail::fiber * fresh_fiber();
+    /// keep an abandoned fiber around for reuse, or give it back to the pool
+    void recycle(detail::fiber * f) noexcept;
+    /// schedule everything in the timing wheel that is due by @p now. true if that was anything
+    bool expire(chrono::clock::time_point now);
+    /// schedule the action of a timer that came due, unless it was cancelled. true if it was scheduled
+    bool fire(detail::timer_node * n);
+    /// take the next task to run from our own queues, dropping any that were cancelled. empty if that was all of them
+    task take();
+    /// deal a task from @p c to a peer that asked for work, minding affinity
+    void deal(int c);
+    /// a peer among the first @p active workers to deal to, by the pool's @ref pool::victims policy. needs @p active > 1
+    int victim(int active) noexcept;
+    /// out of local work: ask a peer for some and watch the pool's inboxes. returns an empty task on shutdown
+    task acquire();
+    /// move submitted tasks from the inbox @p i into our queues
+    bool drain(int i);
+    /// move submitted tasks from any inbox, starting with our own, into our queues
+    bool drain();
+    /// sleep until woken by @ref wake, or until @p timeout passes
+    void park(chrono::clock::duration timeout);
+    /// one round of the scheduler while we are not among the pool's active workers
+    void retire();
+    /// pass everything in our queues to active peers
+    void hand_off();
+    /// wake this worker if it is parked
+    void wake();
+
+    int passed[priority_levels]; ///< times each non-empty class has been passed over since it last ran
+
+    detail::timer_wheel timers;                         ///< work waiting on the clock
+    unsigned rotation;                      ///< the last peer dealt to under @ref victim_policy::round_robin
+    chrono::clock::duration deal_delay;     ///< mean time between deals
+    chrono::clock::time_point deal_deadline; ///< when we next deal out work
+
+    detail::fiber * running;                      ///< the fiber we are running on
+    std::vector<detail::fiber*> spare;            ///< fibers ready for reuse
+    boost::context::detail::fcontext_t home;      ///< the thread's own stack, to return to on shutdown
+
+    /// how many spare fibers to keep around
+    static const std::size_t spare_limit = 16;
+
+    std::mutex parking;                ///< guards @ref sleeping transitions made by wakers
+    std::condition_variable wakeup;    ///< signalled to unpark
+    std::atomic<bool> sleeping;        ///< are we parked, or about to be?
+
+    std::atomic<std::uint64_t> idle_time; ///< nanoseconds spent looking for work, ever. read by the @ref pool::autoscale thread
+    std::atomic<std::size_t> backlog;     ///< how many tasks we had queued when we last looked. read by the @ref pool::autoscale thread
   };
 
-  /// a work-sharing thread pool
+  /// @brief When @ref pool::autoscale grows and shrinks a pool.
+  struct scaling_policy {
+    int min_workers;                  ///< never shrink below this many active workers
+    std::chrono::milliseconds period; ///< how often to look
+    double grow_backlog;              ///< grow when active workers average more than this many queued tasks each, and are rarely idle
+    double shrink_idle;               ///< shrink when active workers spent more than this fraction of the last period idle
+
+    scaling_policy(int min_workers = 1, std::chrono::milliseconds period = std::chrono::milliseconds(10), double grow_backlog = 4, double shrink_idle = 0.5) noexcept
+      : min_workers(min_workers), period(period), grow_backlog(grow_backlog), shrink_idle(shrink_idle) {}
+  };
+
+  /// @brief a work-sharing thread pool
+  ///
+  /// A pool has @ref N workers, of which the first @ref active take part at any one time. The rest are retired: they
+  /// hand whatever work they hold to active peers and sleep until @ref resize calls them back, so several pools in a
+  /// process can trade cores between them.
   struct pool {
     /// @brief Create a pool
     /// @param N number of workers
     /// @param rng random number generator used to seed local worker random number generators
     /// @param args the initial batch of tasks used to seed the pool
-    template <typename ... Ts> pool(int N, std::mt19937 & rng, Ts && ... args);
+    template <typename ... Ts> pool(int N, std::mt19937 & rng, Ts && ... args) : pool(N, N, rng, std::forward<Ts>(args)...) {}
+
+    /// @brief Create a pool that may grow to @p N workers, with @p active of them running to start with
+    template <typename ... Ts> pool(int N, int active, std::mt19937 & rng, Ts && ... args);
 
     virtual ~pool();
 
-    int N;                                               ///< the number of actual workers
-    memory::isolated<std::atomic<task*>> s[max_workers]; ///< mailboxes for sharing work
-    std::vector<std::thread> threads;                    ///< the threads that run the workers
-    std::atomic<bool> shutdown;                          ///< flag used to shut everything down gracefully
+    /// @brief Hand @p f to the pool. Safe to call from any thread, including ones outside the pool.
+    ///
+    /// The task lands in one of the pool's inboxes, which workers drain when they run low on work, and a parked worker is woken to take it.
+    /// It is stored in the submitting worker's arena if that belongs to this pool, and on the aligned heap otherwise.
+    template <typename F> void submit(F && f, fib::priority level = priority::normal) {
+      task t(submit_arena(), std::forward<F>(f));
+      t.get()->level = level;
+      detail::task_node * n = t.release();
+      inject(n, n);
+    }
+
+    /// @brief Hand @p f to the pool, to run under the cancellation token @p c. Safe to call from any thread.
+    ///
+    /// Plain @ref submit doesn't inherit the submitter's token, even from inside a task.
+    template <typename F> void submit(cancellation c, F && f, fib::priority level = priority::normal) {
+      task t(submit_arena(), std::forward<F>(f));
+      t.get()->level = level;
+      t.get()->token = detail::share(c.get());
+      detail::task_node * n = t.release();
+      inject(n, n);
+    }
+
+    /// @brief Hand @p f to the pool, to run on a worker matching @p where. Safe to call from any thread.
+    template <typename F> void submit(affinity where, F && f, fib::priority level = priority::normal) {
+      task t(submit_arena(), std::forward<F>(f));
+      t.get()->level = level;
+      int i = route(t.get(), where, nullptr);
+      detail::task_node * n = t.release();
+      if (i < 0) inject(n, n);
+      else inject_to(i, n, n);
+    }
+
+    /// @brief Hand every callable in [@p first, @p last) to the pool. Safe to call from any thread.
+    ///
+    /// Tasks are linked together and published @ref bulk_chunk at a time, with one atomic operation per chunk.
+    template <typename It> void submit_bulk(It first, It last, fib::priority level = priority::normal) {
+      detail::task_node * head = nullptr, * tail = nullptr;
+      std::size_t n = 0;
+      try {
+        for (; first != last; ++first) {
+          task t(submit_arena(), *first);
+          t.get()->level = level;
+          // prepend, so the oldest ends up deepest in the inbox and is the first out when a worker walks it
+          detail::task_node * node = t.release();
+          node->next = head;
+          head = node;
+          if (tail == nullptr) tail = node;
+          if (++n == bulk_chunk) {
+            inject(head, tail);
+            head = tail = nullptr;
+            n = 0;
+          }
+        }
+      } catch (...) {
+        if (head != nullptr) inject(head, tail);
+        throw;
+      }
+      if (head != nullptr) inject(head, tail);
+    }
+
+    /// @brief Resume the suspended fiber @p f on one of our workers. Safe to call from any thread.
+    void resume(detail::fiber * f) noexcept {
+      inject(f, f);
+    }
+
+    /// @brief Hand @p t to the pool at its own priority. Safe to call from any thread.
+    void post(task t) noexcept {
+      detail::task_node * n = t.release();
+      inject(n, n);
+    }
+
+    /// the NUMA node worker @p i is bound to
+    int node_of(int i) const noexcept { return workers[i]->node; }
+
+    /// how many workers are taking part right now
+    int active() const noexcept { return active_workers.load(std::memory_order_relaxed); }
+
+    /// @brief Run with the first @p n workers, clamped to [1, @ref N]. Safe to call from any thread.
+    ///
+    /// Workers called back start asking their peers for work at once. Retired workers finish the task they are running,
+    /// pass everything they have queued to active peers, and go to sleep. Timers they hold are passed on as they come due.
+    void resize(int n) noexcept;
+
+    /// @brief Start a thread that calls @ref resize by @p policy, replacing any already running.
+    ///
+    /// It watches how much work each active worker has queued and how long they spend idle, and adds or retires a worker at a time.
+    void autoscale(const scaling_policy & policy = scaling_policy());
+
+    /// stop the @ref autoscale thread, if there is one, leaving the pool at its current size
+    void stop_autoscaling();
+
+    /// how many tasks @ref submit_bulk publishes at a time
+    static const std::size_t bulk_chunk = 128;
+
+    int N;                                                                ///< the number of actual workers, active or not
+    memory::isolated<std::atomic<detail::task_node*>> s[max_workers];     ///< mailboxes for sharing work
+    memory::isolated<std::atomic<detail::task_node*>> inbox[max_workers]; ///< stacks of externally submitted tasks, sharded to spread out submitters
+    std::vector<std::thread> threads;                                     ///< the threads that run the workers
+    std::atomic<bool> shutdown;                                           ///< flag used to shut everything down gracefully
+    std::atomic<spawn_policy> spawning;                                   ///< what @ref worker::spawn does by default. help_first unless changed
+    std::atomic<victim_policy> victims;                                   ///< who workers deal to. random unless changed
 
 private:
-    std::vector<worker> workers; ///< direct handles to each of our workers. not for public consumption
+    friend struct worker;
+    std::vector<std::unique_ptr<worker>> workers; ///< direct handles to each of our workers. not for public consumption
+
+    boost::context::protected_fixedsize_stack stacks; ///< allocates fiber stacks
+    std::mutex fibers_lock;                           ///< guards @ref fibers
+    detail::fiber * fibers;                           ///< every fiber we've made and not yet freed, so none outlive us
+    std::vector<std::vector<int>> residents;          ///< which of our workers live on each NUMA node
+    std::atomic<int> active_workers;                  ///< workers [0, active_workers) take part; the rest are retired
+
+    std::thread scaler;                   ///< runs @ref scale
+    std::mutex scaler_lock;               ///< guards @ref scaling
+    std::condition_variable scaler_wake;  ///< tells @ref scaler to stop
+    bool scaling;                         ///< should @ref scaler keep going?
+
+    /// the @ref autoscale loop
+    void scale(scaling_policy policy);
+
+    /// make a new fiber
+    detail::fiber * make_fiber();
+    /// free a fiber that isn't running
+    void free_fiber(detail::fiber * f) noexcept;
+
+    /// where @ref submit stores tasks: the arena of the calling worker if it is one of ours, and the aligned heap otherwise
+    memory::arena * submit_arena() const noexcept {
+      worker * w = worker::current();
+      return w != nullptr && &w->p == this ? &w->arena : nullptr;
+    }
+
+    /// push the chain @p head ... @p tail onto an inbox and wake somebody up to deal with it
+    void inject(detail::task_node * head, detail::task_node * tail) noexcept;
+    /// push the chain @p head ... @p tail onto the inbox of worker @p i, waking it if need be
+    void inject_to(int i, detail::task_node * head, detail::task_node * tail) noexcept;
+    /// push the chain @p head ... @p tail onto inbox @p i
+    void push(int i, detail::task_node * head, detail::task_node * tail) noexcept;
+
+    /// @brief record @p where on @p n.
+    ///
+    /// Returns which worker to send @p n to, or -1 if @p from, which may be null, will do or there is no preference we can meet.
+    int route(detail::task_node * n, const affinity & where, worker * from) noexcept;
+    /// a worker on @p node other than @p from, or -1 if there is none
+    int resident(int node, worker * from) noexcept;
+
+    void preload(int) {}
+    /// distribute tasks round-robin to start before the threads kick in
+    template <typename T, typename ... Ts> void preload(int i, T && t, Ts && ... ts) {
+      workers[i]->q[int(priority::normal)].push_front(task(workers[i]->arena, std::forward<T>(t)));
+      preload((i + 1) % active(), std::forward<Ts>(ts)...);
+    }
   };
 
   namespace detail {
     /// a placeholder task used to indicate lack of work
-    struct dummy_task : task {
+    struct dummy_task final : task_node {
+      void run(worker &) override {}
+      void destroy() noexcept override {}
+
       /// @brief The only instance of dummy_task.
       ///
-      /// This task gets posted in a mailbox to indicate that the corresponding worker is looking for work
+      /// This task gets posted in a mailbox to indicate that the corresponding worker is not looking for work
       static dummy_task instance;
     };
   };
 
-  template <typename ... Ts> pool::pool(int N, std::mt19937 & rng, Ts && ... args) : N(N) {
-    for (int i = 0;i < N;++i)
+  template <typename ... Ts> pool::pool(int N, int active, std::mt19937 & rng, Ts && ... args) : N(N), fibers(nullptr), scaling(false) {
+    active_workers.store(active < 1 ? 1 : active > N ? N : active, std::memory_order_relaxed);
+    for (int i = 0;i < N;++i) {
       s[i].data.store(&detail::dummy_task::instance, std::memory_order_relaxed);
+      inbox[i].data.store(nullptr, std::memory_order_relaxed);
+    }
 
     shutdown.store(false, std::memory_order_relaxed);
+    spawning.store(spawn_policy::help_first, std::memory_order_relaxed);
+    victims.store(victim_policy::random, std::memory_order_relaxed);
 
+    // spread the workers over the nodes in contiguous blocks
+    int nodes = numa().nodes;
+    residents.resize(std::size_t(nodes));
     for (int i = 0;i < N;++i) {
       std::seed_seq s { rng(), rng(), rng(), rng() };
-      workers.push_back(worker(*this, i, s));
+      int node = int(long(i) * nodes / N);
+      workers.emplace_back(new worker(*this, i, node, s));
+      residents[std::size_t(node)].push_back(i);
     }
 
-    {
-      int i = 0;
-      // pre-load our starting tasks
-      for (auto && task : { std::function<void(worker&)>(args) ... }) {
-        workers[i++].q.push_front(task); // distribute tasks round-robin to start before the threads kick in
-        i %= N;
+    // pre-load our starting tasks
+    preload(0, std::forward<Ts>(args)...);
+
+    for (int i = 0; i < N;++i) {
+      worker * w = workers[i].get();
+      threads.push_back(std::thread([w] { w->run(); }));
+    }
+  }
+
+  template <typename F> void worker::spawn(F && f) {
+    spawn(p.spawning.load(std::memory_order_relaxed), std::forward<F>(f));
+  }
+
+  template <typename F> void worker::spawn(affinity where, F && f) {
+    task t(arena, std::forward<F>(f));
+    t.get()->level = level;
+    t.get()->token = detail::share(token);
+    int i = p.route(t.get(), where, this);
+    if (i < 0) q[int(level)].push_back(std::move(t));
+    else {
+      detail::task_node * n = t.release();
+      p.inject_to(i, n, n);
+    }
+  }
+
+  template <typename F> void worker::spawn(spawn_policy how, F && f) {
+    if (how == spawn_policy::help_first) {
+      spawn(level, std::forward<F>(f));
+      return;
+    }
+    typedef typename std::decay<F>::type child_type;
+    suspend([&f](detail::fiber * parent) {
+      // get the child off the parent's stack before anybody can resume the parent
+      child_type child(std::forward<F>(f));
+      worker & w = *current();
+      pool & p = w.p;
+      // the parent's task owns the token, and may finish before the child does
+      cancellation token(detail::share(w.token));
+      w.q[int(parent->level)].push_back(task(parent));
+      // on to the child, as step would run it. it may suspend in turn, so w is not to be trusted afterwards
+      trace::begin(trace::what::task, int(w.level));
+      try {
+        child(w);
+        trace::end(trace::what::task);
+      } catch (...) {
+        p.shutdown.store(true, std::memory_order_release);
+        throw;
       }
+    });
+  }
+
+  /// where the current task is running
+  namespace this_worker {
+    /// the id of the worker running the current task, or -1 outside of a pool
+    inline int id() noexcept {
+      worker * w = worker::current();
+      return w ? w->id : -1;
     }
 
-    for (int i = 0; i < N;++i) {
-      auto w = workers[i];
-      threads.push_back(std::thread([&w] { w.run(); }));
+    /// the NUMA node of the worker running the current task, or -1 outside of a pool
+    inline int node() noexcept {
+      worker * w = worker::current();
+      return w ? w->node : -1;
     }
   }
 }
@@ -74,9 +74,12 @@ namespace fib {
   
       circular_array(std::size_t N, circular_array * p = nullptr) : N(N), allocator(), previous(p) {
         assert(N > 0);
-        assert((N&~N) == N); // N is a power of two
+        assert((N&(N-1)) == 0); // N is a power of two
         items = reinterpret_cast<std::atomic<T>*>(allocator.allocate(N));
       }
+      ~circular_array() noexcept {
+        allocator.deallocate(reinterpret_cast<pointer>(items), N);
+      }
       std::size_t size() const noexcept {
         return N;
       }
@@ -86,7 +89,7 @@ namespace fib {
       void put(std::size_t index, T x) noexcept {
         items[index & (size() - 1)].store(x, std::memory_order_relaxed);
       }
-      FIB_DECLSPEC_NOALIAS FIB_DECLSPEC_RESTRICT circular_array * grow(size_t top, size_t bottom) const FIB_ATTRIBUTE_RETURNS_NONNULL {
+      FIB_DECLSPEC_NOALIAS FIB_DECLSPEC_RESTRICT circular_array * grow(size_t top, size_t bottom) FIB_ATTRIBUTE_RETURNS_NONNULL {
         circular_array * new_array = new circular_array(N * 2, this);
         for (std::size_t i = top; i != bottom; ++i)
           new_array->put(i, get(i));
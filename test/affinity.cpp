@@ -0,0 +1,70 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::atomic<bool> busy(false), release(false);
+  std::atomic<long> ran(0);
+
+  void count(fib::worker &) { ran.fetch_add(1); }
+}
+
+int main() {
+  FIB_CHECK(fib::this_worker::id() == -1);
+  FIB_CHECK(fib::this_worker::node() == -1);
+
+  std::mt19937 rng(1);
+
+  // the pool preloads its starting tasks one per worker, so here worker 1 is pinned down spinning
+  // while worker 0 places work: nobody can take anything from where it lands
+  {
+    fib::pool p(2, rng,
+      [&p](fib::worker & w) {
+        FIB_CHECK(w.id == 0);
+        while (!busy.load()) {}
+        int normal = int(fib::priority::normal);
+        w.spawn(fib::affinity::on_worker(1), count);
+        FIB_CHECK(p.inbox[1].data.load() != nullptr);
+        FIB_CHECK(w.q[normal].empty());
+        w.spawn(fib::affinity::for_key(3), count); // keys go to key % active
+        w.spawn(fib::affinity::on_worker(3), count); // ids wrap around too
+        FIB_CHECK(w.q[normal].empty());
+        w.spawn(fib::affinity::on_worker(0), count);
+        FIB_CHECK(w.q[normal].size() == 1);
+        w.spawn(fib::affinity::for_key(4), count);
+        FIB_CHECK(w.q[normal].size() == 2);
+        w.spawn(fib::affinity(), count);
+        FIB_CHECK(w.q[normal].size() == 3);
+        // we live on our own node
+        w.spawn(fib::affinity::on_node(std::size_t(w.node)), count);
+        FIB_CHECK(w.q[normal].size() == 4);
+        release.store(true);
+      },
+      [](fib::worker & w) {
+        FIB_CHECK(w.id == 1);
+        busy.store(true);
+        while (!release.load()) {}
+      });
+    while (ran.load() < 7) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // submissions from outside land where they are told to, and are run
+  ran.store(0);
+  {
+    fib::pool p(4, rng);
+    for (int i = 0; i < p.N; ++i) FIB_CHECK(p.node_of(i) >= 0 && p.node_of(i) < fib::numa().nodes);
+    std::atomic<int> where[8];
+    for (int k = 0; k < 8; ++k) where[k].store(-1);
+    for (int k = 0; k < 8; ++k) p.submit(fib::affinity::for_key(std::size_t(k)), [&where, k](fib::worker & w) {
+      where[k].store(w.id);
+      ran.fetch_add(1);
+    });
+    for (int k = 0; k < 100; ++k) p.submit(fib::affinity::on_node(std::size_t(k)), count);
+    while (ran.load() < 108) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    for (int k = 0; k < 8; ++k) FIB_CHECK(where[k].load() >= 0 && where[k].load() < p.N);
+  }
+}
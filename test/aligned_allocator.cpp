@@ -0,0 +1,66 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "fib/memory/aligned_allocator.h"
+#include "check.h"
+
+using fib::memory::detail::allocate_aligned_memory;
+using fib::memory::detail::deallocate_aligned_memory;
+
+namespace {
+  std::size_t size_of(std::size_t i) { return (i * 37) % 9000 + 1; }
+  std::size_t align_of(std::size_t i) { return std::size_t(16) << (i % 4); }
+}
+
+int main() {
+  // alignment is honoured across the size classes, and blocks don't overlap
+  {
+    std::vector<void *> v(4096);
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      v[i] = allocate_aligned_memory(align_of(i), size_of(i));
+      FIB_CHECK(v[i] != nullptr);
+      FIB_CHECK(reinterpret_cast<std::uintptr_t>(v[i]) % align_of(i) == 0);
+      std::memset(v[i], int(i & 0xff), size_of(i));
+    }
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      const unsigned char * p = static_cast<const unsigned char *>(v[i]);
+      for (std::size_t j = 0; j < size_of(i); ++j) FIB_CHECK(p[j] == (i & 0xff));
+      deallocate_aligned_memory(v[i]);
+    }
+  }
+
+  // memory allocated on one thread may be freed on another, including after the allocating thread has exited
+  for (int round = 0; round < 8; ++round) {
+    std::vector<void *> v(8192);
+    std::thread producer([&] {
+      for (std::size_t i = 0; i < v.size(); ++i) {
+        v[i] = allocate_aligned_memory(align_of(i), size_of(i));
+        std::memset(v[i], 1, size_of(i));
+      }
+    });
+    producer.join();
+    std::thread consumer([&] {
+      for (void * p : v) deallocate_aligned_memory(p);
+    });
+    consumer.join();
+  }
+
+  // and the freed blocks are reused: the heap doesn't grow without bound
+  {
+    void * a = allocate_aligned_memory(64, 100);
+    deallocate_aligned_memory(a);
+    void * b = allocate_aligned_memory(64, 100);
+    FIB_CHECK(a == b);
+    deallocate_aligned_memory(b);
+  }
+
+  // large requests bypass the slabs
+  {
+    void * big = allocate_aligned_memory(128, std::size_t(1) << 20);
+    FIB_CHECK(reinterpret_cast<std::uintptr_t>(big) % 128 == 0);
+    std::memset(big, 0, std::size_t(1) << 20);
+    deallocate_aligned_memory(big);
+  }
+}
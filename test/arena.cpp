@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+using fib::memory::arena;
+
+namespace {
+  std::atomic<long> calls(0);
+
+  // every spawn allocates its task from the spawning worker's arena, and many of them run, and are freed, elsewhere
+  void tree(fib::worker & w, int n) {
+    calls.fetch_add(1, std::memory_order_relaxed);
+    std::vector<int, fib::memory::arena_allocator<int>> scratch;
+    for (int i = 0; i < n; ++i) scratch.push_back(i);
+    FIB_CHECK(scratch.get_allocator().source == &w.arena);
+    if (n < 2) return;
+    w.spawn(tree, n - 1);
+    w.spawn([n](fib::worker & w) { tree(w, n - 2); });
+  }
+}
+
+int main() {
+  // blocks freed by another thread go back to the owner when it next runs dry
+  {
+    arena a;
+    arena::scope bound(a);
+    std::vector<void *> first(1000);
+    for (void * & p : first) p = a.allocate(48);
+    std::thread other([&] {
+      FIB_CHECK(arena::current() == nullptr);
+      for (void * p : first) a.deallocate(p, 48);
+    });
+    other.join();
+    std::vector<void *> second(1000);
+    for (void * & p : second) p = a.allocate(48);
+    std::sort(first.begin(), first.end());
+    std::sort(second.begin(), second.end());
+    FIB_CHECK(first == second);
+    for (void * p : second) a.deallocate(p, 48);
+  }
+
+  // large blocks go to the aligned heap, from any thread
+  {
+    arena a;
+    void * p = a.allocate(arena::max_small + 1);
+    std::thread other([&] { a.deallocate(p, arena::max_small + 1); });
+    other.join();
+  }
+
+  // outside a worker, arena_allocator falls back to the aligned heap
+  {
+    std::vector<int, fib::memory::arena_allocator<int>> v(100, 1);
+    FIB_CHECK(v.get_allocator().source == nullptr);
+  }
+
+  // a recursive fork across a pool
+  {
+    long expected = 1, previous = 1;
+    for (int i = 2; i <= 20; ++i) {
+      long next = expected + previous + 1;
+      previous = expected;
+      expected = next;
+    }
+    std::mt19937 rng(1);
+    fib::pool p(4, rng, [](fib::worker & w) { tree(w, 20); });
+    while (calls.load() < expected) std::this_thread::yield();
+    FIB_CHECK(calls.load() == expected);
+  }
+}
@@ -0,0 +1,133 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::atomic<long> spawned(0), ran_cancelled(0);
+
+  // an endless binary fork, stopped only by cancellation
+  void endless(fib::worker & w) {
+    spawned.fetch_add(1);
+    if (fib::this_fiber::cancelled()) {
+      ran_cancelled.fetch_add(1); // possible for tasks already running, never for ones queued before the cancel
+      return;
+    }
+    w.spawn(endless);
+    w.spawn(endless);
+  }
+
+  void settle() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); }
+}
+
+int main() {
+  // cancelling a token cancels its descendants, and nothing above or beside it
+  {
+    fib::cancellation root = fib::cancellation::make();
+    fib::cancellation left = root.child(), right = root.child();
+    fib::cancellation leaf = left.child();
+    FIB_CHECK(bool(root) && !fib::cancellation());
+    left.cancel();
+    FIB_CHECK(left.cancelled() && leaf.cancelled());
+    FIB_CHECK(!root.cancelled() && !right.cancelled());
+    root.cancel();
+    FIB_CHECK(right.cancelled());
+    FIB_CHECK(root.child().cancelled()); // born cancelled
+    fib::cancellation().cancel();        // does nothing
+  }
+
+  // children may outlive their parents' handles, and be dropped in any order
+  {
+    fib::cancellation leaf;
+    {
+      fib::cancellation root = fib::cancellation::make();
+      leaf = root.child().child();
+    }
+    FIB_CHECK(!leaf.cancelled());
+    fib::cancellation root = fib::cancellation::make();
+    fib::cancellation a = root.child();
+    root = fib::cancellation();
+    a.cancel();
+  }
+
+  // callbacks run once when cancelled, at once if it already was, and never once they are gone
+  {
+    fib::cancellation root = fib::cancellation::make();
+    fib::cancellation child = root.child();
+    int fired = 0, gone = 0;
+    fib::cancellation_callback on_child(child, [&] { ++fired; });
+    fib::cancellation_callback on_root(root, [&] { ++fired; });
+    { fib::cancellation_callback dropped(child, [&] { ++gone; }); }
+    root.cancel();
+    root.cancel();
+    FIB_CHECK(fired == 2 && gone == 0);
+    fib::cancellation_callback late(child, [&] { ++fired; });
+    FIB_CHECK(fired == 3);
+    fib::cancellation_callback never(fib::cancellation(), [&] { ++gone; });
+    FIB_CHECK(gone == 0);
+  }
+
+  std::mt19937 rng(1);
+  fib::pool p(4, rng);
+
+  // outside a pool, and in tasks submitted without a token, nothing is ever cancelled
+  FIB_CHECK(!fib::this_fiber::cancelled());
+  FIB_CHECK(!fib::cancellation::current());
+  FIB_CHECK(!fib::async(p, [](fib::worker &) { return bool(fib::cancellation::current()); }).get());
+
+  // spawned tasks inherit the token, so cancelling it stops the whole tree, queued work and all
+  {
+    fib::cancellation c = fib::cancellation::make();
+    p.submit(c, endless);
+    while (spawned.load() < 100000) std::this_thread::yield();
+    c.cancel();
+    settle();
+    long after = spawned.load();
+    settle();
+    FIB_CHECK(spawned.load() == after);
+    FIB_CHECK(ran_cancelled.load() <= p.N);
+  }
+
+  // a task submitted under a cancelled token never runs, and a child token reaches through spawn(cancellation, f)
+  {
+    std::atomic<int> ran(0);
+    fib::cancellation dead = fib::cancellation::make();
+    dead.cancel();
+    p.submit(dead, [&](fib::worker &) { ran.fetch_add(1); });
+    fib::cancellation parent = fib::cancellation::make();
+    fib::latch started(1);
+    p.submit([&](fib::worker & w) {
+      w.spawn(parent.child(), [&](fib::worker &) {
+        FIB_CHECK(fib::cancellation::current().get() != parent.get());
+        started.count_down();
+        while (!fib::this_fiber::cancelled()) fib::this_fiber::yield();
+        ran.fetch_add(10);
+      });
+    });
+    started.wait();
+    parent.cancel();
+    while (ran.load() < 10) std::this_thread::yield();
+    settle();
+    FIB_CHECK(ran.load() == 10);
+  }
+
+  // sleepers under a cancelled token wake early
+  {
+    fib::cancellation c = fib::cancellation::make();
+    fib::latch asleep(1);
+    fib::promise<std::chrono::nanoseconds> slept;
+    fib::future<std::chrono::nanoseconds> result = slept.get_future();
+    p.submit(c, [&](fib::worker &) {
+      fib::chrono::clock::time_point start = fib::chrono::clock::now();
+      asleep.count_down();
+      fib::this_fiber::sleep_for(std::chrono::seconds(30));
+      slept.set_value(fib::chrono::clock::now() - start);
+    });
+    asleep.wait();
+    c.cancel();
+    FIB_CHECK(result.get() < std::chrono::seconds(10));
+  }
+}
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::atomic<long> done(0);
+
+  void wait_for(long n) {
+    while (done.load() < n) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    done.store(0);
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  fib::pool p(4, rng);
+
+  // many producers and consumers, inside and outside the pool, with rendezvous, tiny and roomy buffers.
+  // every value arrives exactly once, and closing lets the consumers finish
+  for (std::size_t capacity : { std::size_t(0), std::size_t(1), std::size_t(64) }) {
+    fib::channel<long> ch(capacity);
+    const int producers = 4, consumers = 4;
+    const long n = 5000;
+    std::atomic<long> sum(0), count(0);
+    std::atomic<int> live(producers);
+    for (int i = 0; i < producers; ++i) p.submit([&](fib::worker &) {
+      for (long k = 1; k <= n; ++k) FIB_CHECK(ch.push(long(k)));
+      if (live.fetch_sub(1) == 1) ch.close();
+      done.fetch_add(1);
+    });
+    for (int i = 0; i < consumers; ++i) p.submit([&](fib::worker &) {
+      long v;
+      while (ch.pop(v)) {
+        sum.fetch_add(v);
+        count.fetch_add(1);
+      }
+      done.fetch_add(1);
+    });
+    std::thread outside([&] {
+      long v;
+      while (ch.pop(v)) {
+        sum.fetch_add(v);
+        count.fetch_add(1);
+      }
+    });
+    wait_for(producers + consumers);
+    outside.join();
+    FIB_CHECK(count.load() == producers * n);
+    FIB_CHECK(sum.load() == producers * n * (n + 1) / 2);
+
+    // closed for good
+    long v = 0;
+    FIB_CHECK(!ch.push(long(1)));
+    FIB_CHECK(!ch.try_push(long(1)));
+    FIB_CHECK(!ch.pop(v));
+  }
+
+  // move only values, from a thread outside the pool into a fiber, arriving in order
+  {
+    fib::channel<std::unique_ptr<int>> ch(2);
+    std::atomic<bool> ordered(true);
+    std::atomic<long> got(0);
+    p.submit([&](fib::worker &) {
+      std::unique_ptr<int> v;
+      int next = 0;
+      while (ch.pop(v)) {
+        if (*v != next++) ordered.store(false);
+        got.fetch_add(1);
+      }
+      done.fetch_add(1);
+    });
+    for (int i = 0; i < 1000; ++i) FIB_CHECK(ch.push(std::unique_ptr<int>(new int(i))));
+    ch.close();
+    wait_for(1);
+    FIB_CHECK(got.load() == 1000);
+    FIB_CHECK(ordered.load());
+  }
+
+  // try_push and try_pop never wait, and what is left buffered is freed with the channel
+  {
+    fib::channel<std::unique_ptr<int>> ch(2);
+    std::unique_ptr<int> v;
+    FIB_CHECK(!ch.try_pop(v));
+    FIB_CHECK(ch.try_push(std::unique_ptr<int>(new int(1))));
+    FIB_CHECK(ch.try_push(std::unique_ptr<int>(new int(2))));
+    FIB_CHECK(!ch.try_push(std::unique_ptr<int>(new int(3))));
+    FIB_CHECK(ch.try_pop(v) && *v == 1);
+  }
+}
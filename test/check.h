@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/// @file test/check.h
+/// @brief the little the tests need. each test is a program that exits nonzero on the first failed @ref FIB_CHECK
+
+/// @cond PRIVATE
+namespace fib {
+  namespace test {
+    [[noreturn]] inline void fail(const char * what, const char * file, int line) {
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+      std::fflush(stderr);
+      std::abort();
+    }
+  }
+}
+/// @endcond
+
+/// fail the test unless @p e holds. evaluated in every build
+#define FIB_CHECK(e) ((e) ? (void)0 : fib::test::fail(#e, __FILE__, __LINE__))
@@ -0,0 +1,48 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "fib/chrono.h"
+#include "check.h"
+
+using fib::chrono::tsc_clock;
+
+int main() {
+  // monotonic, from every thread, whether or not it reads the counter
+  {
+    std::vector<std::thread> ts;
+    for (int t = 0; t < 4; ++t) ts.emplace_back([] {
+      tsc_clock::time_point last = tsc_clock::now();
+      for (int i = 0; i < 100000; ++i) {
+        tsc_clock::time_point now = tsc_clock::now();
+        FIB_CHECK(now >= last);
+        last = now;
+      }
+    });
+    for (std::thread & t : ts) t.join();
+  }
+
+  // shares an epoch and a rate with the steady clock, to well within a millisecond over a few
+  for (int i = 0; i < 3; ++i) {
+    std::chrono::steady_clock::time_point s0 = std::chrono::steady_clock::now();
+    tsc_clock::time_point t0 = tsc_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    tsc_clock::time_point t1 = tsc_clock::now();
+    std::chrono::steady_clock::time_point s1 = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds skew = tsc_clock::to_steady(t0) - s0;
+    FIB_CHECK(skew < std::chrono::milliseconds(1) && skew > -std::chrono::milliseconds(1));
+    std::chrono::nanoseconds drift = (s1 - s0) - (t1 - t0);
+    FIB_CHECK(drift < std::chrono::milliseconds(1) && drift > -std::chrono::milliseconds(1));
+    FIB_CHECK(t1 - t0 >= std::chrono::milliseconds(5));
+  }
+
+  // conversions round trip
+  std::chrono::steady_clock::time_point s = std::chrono::steady_clock::now();
+  FIB_CHECK(tsc_clock::to_steady(tsc_clock::from_steady(s)) == s);
+
+  // and the rounding helpers round the right way
+  FIB_CHECK(fib::chrono::ceil<std::chrono::milliseconds>(std::chrono::microseconds(1001)).count() == 2);
+  FIB_CHECK(fib::chrono::floor<std::chrono::milliseconds>(std::chrono::microseconds(1999)).count() == 1);
+  FIB_CHECK(fib::chrono::ceil<std::chrono::milliseconds>(std::chrono::microseconds(-1001)).count() == -1);
+  FIB_CHECK(fib::chrono::floor<std::chrono::milliseconds>(std::chrono::microseconds(-1001)).count() == -2);
+}
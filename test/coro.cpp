@@ -0,0 +1,124 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+// only built with ENABLE_COROUTINES
+
+namespace {
+  fib::coro::task<int> leaf(int i) {
+    co_await fib::coro::yield();
+    co_return i;
+  }
+
+  fib::coro::task<long> sum(int n) {
+    long s = 0;
+    for (int i = 0; i < n; ++i) s += co_await leaf(i);
+    fib::chrono::clock::time_point start = fib::chrono::clock::now();
+    co_await fib::coro::sleep_for(std::chrono::microseconds(200));
+    FIB_CHECK(fib::chrono::clock::now() - start >= std::chrono::microseconds(200));
+    s += co_await fib::async(*fib::worker::current(), [](fib::worker &) { return 1000; });
+    co_return s;
+  }
+
+  fib::coro::task<void> thrower() {
+    co_await fib::coro::yield();
+    throw std::runtime_error("thrown");
+  }
+
+  // yield requeues us at the priority we were running at
+  fib::coro::task<int> level_after_yield() {
+    co_await fib::coro::yield();
+    co_return int(fib::worker::current()->level);
+  }
+
+  // spins in yield until told to go, then sleeps, and reports whether its token was cancelled meanwhile
+  fib::coro::task<bool> parked(std::atomic<bool> & go) {
+    while (!go.load()) co_await fib::coro::yield();
+    co_await fib::coro::sleep_for(std::chrono::microseconds(200));
+    co_return fib::this_fiber::cancelled();
+  }
+
+  fib::coro::generator<int> naturals(int n) {
+    for (int i = 0; i < n; ++i) co_yield i;
+  }
+
+  fib::coro::generator<int> broken() {
+    co_yield 1;
+    throw std::logic_error("thrown");
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  fib::pool p(4, rng);
+
+  // tasks awaiting tasks, sleeps and futures, and exceptions carried out to the future
+  FIB_CHECK(fib::coro::submit(p, sum(100)).get() == 4950 + 1000);
+  bool threw = false;
+  try { fib::coro::submit(p, thrower()).get(); } catch (std::runtime_error &) { threw = true; }
+  FIB_CHECK(threw);
+
+  // lots at once
+  {
+    std::vector<fib::future<long>> fs;
+    for (int i = 0; i < 1000; ++i) fs.push_back(fib::coro::submit(p, sum(10)));
+    for (fib::future<long> & f : fs) FIB_CHECK(f.get() == 45 + 1000);
+  }
+
+  FIB_CHECK(fib::coro::submit(p, level_after_yield(), fib::priority::high).get() == int(fib::priority::high));
+  FIB_CHECK(fib::coro::submit(p, level_after_yield(), fib::priority::low).get() == int(fib::priority::low));
+
+  // hopping from one pool to another
+  {
+    fib::pool q(2, rng);
+    auto hop = [&]() -> fib::coro::task<bool> {
+      co_await fib::coro::schedule_on(q);
+      co_return &fib::worker::current()->p == &q;
+    };
+    FIB_CHECK(fib::coro::submit(p, hop()).get());
+  }
+
+  // cancelling the token of a parked coroutine doesn't drop it, and it can still see the cancellation
+  {
+    fib::cancellation c = fib::cancellation::make();
+    std::atomic<bool> go(false), started(false);
+    fib::future<bool> f;
+    p.submit(c, [&](fib::worker & w) {
+      f = fib::coro::spawn(w, parked(go));
+      started.store(true);
+    });
+    while (!started.load()) std::this_thread::yield();
+    c.cancel();
+    go.store(true);
+    FIB_CHECK(f.get());
+  }
+
+  // generators, on their own and composed
+  {
+    long s = 0;
+    for (int v : naturals(10)) s += v;
+    FIB_CHECK(s == 45);
+    s = 0;
+    naturals(10).map([](int a) { return a * 2; }).where([](int a) { return a % 4 == 0; }).foreach([&](int a) { s += a; });
+    FIB_CHECK(s == 0 + 4 + 8 + 12 + 16);
+    s = 0;
+    naturals(4).then([](int a) { return naturals(a); }).foreach([&](int a) { s += a; });
+    FIB_CHECK(s == 0 + 0 + 1 + 0 + 1 + 2);
+    threw = false;
+    try { for (int v : broken()) (void)v; } catch (std::logic_error &) { threw = true; }
+    FIB_CHECK(threw);
+  }
+
+  // and inside a worker, where their frames come from its arena
+  FIB_CHECK(fib::async(p, [](fib::worker &) {
+    long t = 0;
+    for (int v : naturals(1000)) t += v;
+    return t;
+  }).get() == 499500);
+}
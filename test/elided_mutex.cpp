@@ -0,0 +1,85 @@
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fib/cpu.h"
+#include "fib/elided_mutex.h"
+#include "check.h"
+
+namespace {
+  const int threads = 4;
+  const int rounds = 20000;
+
+  // locks taken during static initialization work, whether or not the path has been picked yet
+  fib::elided_mutex early_mutex;
+  bool early_locked = [] {
+    std::lock_guard<fib::elided_mutex> guard(early_mutex);
+    return early_mutex.is_locked() || fib::elided_mutex::eliding();
+  }();
+}
+
+int main() {
+  // the path is picked once, from cpuid
+  FIB_CHECK(early_locked);
+  FIB_CHECK(!early_mutex.is_locked());
+  FIB_CHECK(&fib::cpu() == &fib::cpu());
+  FIB_CHECK(fib::elided_mutex::eliding() == fib::rtm_supported());
+  FIB_CHECK(!fib::rtm_supported() || fib::cpu().rtm);
+
+  fib::elided_mutex m;
+
+  // mutual exclusion, whether or not we are eliding
+  {
+    long plain = 0;
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; ++t) ts.emplace_back([&] {
+      for (int i = 0; i < rounds; ++i) {
+        std::lock_guard<fib::elided_mutex> guard(m);
+        ++plain;
+      }
+    });
+    for (std::thread & t : ts) t.join();
+    FIB_CHECK(plain == long(threads) * rounds);
+    FIB_CHECK(!m.is_locked());
+  }
+
+  // try_lock sees a lock taken for real
+  {
+    FIB_CHECK(m.try_lock());
+    FIB_CHECK(m.is_locked());
+    std::thread other([&] { FIB_CHECK(!m.try_lock()); });
+    other.join();
+    m.unlock();
+    FIB_CHECK(!m.is_locked());
+  }
+
+  // multi_cas moves a unit from b to a without either reader ever seeing the sum change
+  {
+    std::atomic<long> a(0), b(1000000);
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; ++t) ts.emplace_back([&] {
+      for (int i = 0; i < rounds; ++i) {
+        for (;;) {
+          long x = a.load(), y = b.load();
+          std::atomic<long> * const words[2] = { &a, &b };
+          const long expected[2] = { x, y };
+          const long desired[2] = { x + 1, y - 1 };
+          if (fib::multi_cas(m, words, expected, desired)) break;
+        }
+      }
+    });
+    for (std::thread & t : ts) t.join();
+    FIB_CHECK(a.load() == long(threads) * rounds);
+    FIB_CHECK(a.load() + b.load() == 1000000);
+
+    // and a stale expectation changes nothing
+    std::atomic<long> * const words[2] = { &a, &b };
+    const long expected[2] = { a.load() - 1, b.load() };
+    const long desired[2] = { 0, 0 };
+    FIB_CHECK(!fib::multi_cas(m, words, expected, desired));
+    FIB_CHECK(a.load() == long(threads) * rounds);
+  }
+
+  FIB_CHECK(fib::atomically(m, [] { return 42; }) == 42);
+}
@@ -0,0 +1,208 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  template <typename F> bool fails_with(std::future_errc e, F f) {
+    try {
+      f();
+    } catch (fib::future_error & x) {
+      return x.code() == std::make_error_code(e);
+    }
+    return false;
+  }
+}
+
+int main() {
+  // a promise is satisfied once, by value or by exception, and its future retrieved once
+  {
+    fib::promise<int> p;
+    fib::future<int> f = p.get_future();
+    FIB_CHECK(fails_with(std::future_errc::future_already_retrieved, [&] { p.get_future(); }));
+    FIB_CHECK(!f.is_ready());
+    p.set_value(1);
+    FIB_CHECK(fails_with(std::future_errc::promise_already_satisfied, [&] { p.set_value(2); }));
+    FIB_CHECK(fails_with(std::future_errc::promise_already_satisfied, [&] { p.set_exception(std::make_exception_ptr(3)); }));
+    FIB_CHECK(f.is_ready());
+    FIB_CHECK(f.get() == 1);
+    FIB_CHECK(!f.valid());
+    FIB_CHECK(fails_with(std::future_errc::no_state, [&] { f.get(); }));
+    FIB_CHECK(fails_with(std::future_errc::no_state, [&] { f.is_ready(); }));
+    FIB_CHECK(fails_with(std::future_errc::no_state, [&] { f.wait(); }));
+    FIB_CHECK(fails_with(std::future_errc::no_state, [&] { f.then([](fib::future<int>) {}); }));
+  }
+  {
+    fib::promise<void> p;
+    fib::future<void> f = p.get_future();
+    p.set_exception(std::make_exception_ptr(std::runtime_error("no")));
+    FIB_CHECK(fails_with(std::future_errc::promise_already_satisfied, [&] { p.set_value(); }));
+    bool threw = false;
+    try { f.get(); } catch (std::runtime_error &) { threw = true; }
+    FIB_CHECK(threw);
+  }
+
+  // a timed wait outside any pool gives up, and then sees the value
+  {
+    fib::promise<int> p;
+    fib::future<int> f = p.get_future();
+    FIB_CHECK(f.wait_for(std::chrono::milliseconds(2)) == std::future_status::timeout);
+    p.set_value(4);
+    FIB_CHECK(f.wait_until(fib::chrono::clock::now()) == std::future_status::ready);
+    FIB_CHECK(f.get() == 4);
+    FIB_CHECK(fails_with(std::future_errc::no_state, [&] { f.wait_for(std::chrono::milliseconds(1)); }));
+  }
+
+  // dropping an unsatisfied promise breaks it
+  {
+    fib::future<std::string> f;
+    {
+      fib::promise<std::string> p;
+      f = p.get_future();
+    }
+    FIB_CHECK(fails_with(std::future_errc::broken_promise, [&] { f.get(); }));
+  }
+
+  // a thread outside any pool blocks until another sets the value
+  {
+    fib::promise<std::string> p;
+    fib::future<std::string> f = p.get_future();
+    std::thread other([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      p.set_value("late");
+    });
+    FIB_CHECK(f.get() == "late");
+    other.join();
+  }
+
+  std::mt19937 rng(1);
+  fib::future<int> survivor;
+  {
+    fib::pool p(2, rng);
+
+    // async and then, with spawned and immediate continuations, and exceptions passed along the chain
+    {
+      fib::future<int> f = fib::async(p, [](fib::worker &) { return 20; })
+        .then([](fib::future<int> x) { return x.get() + 1; })
+        .then([](fib::future<int> x) { return x.get() * 2; }, fib::launch::immediate);
+      FIB_CHECK(f.get() == 42);
+
+      fib::future<int> g = fib::async(p, [](fib::worker &) -> int { throw std::runtime_error("no"); })
+        .then([](fib::future<int> x) { return x.get() + 1; });
+      bool threw = false;
+      try { g.get(); } catch (std::runtime_error &) { threw = true; }
+      FIB_CHECK(threw);
+
+      std::atomic<bool> ran(false);
+      fib::async(p, [&](fib::worker &) { ran.store(true); }).get();
+      FIB_CHECK(ran.load());
+    }
+
+    // waiting inside the pool suspends the fiber rather than blocking the worker, so a lone worker can't deadlock on it
+    {
+      fib::pool lone(1, rng);
+      fib::promise<int> inner;
+      fib::future<int> inner_result = inner.get_future();
+      fib::future<int> outer = fib::async(lone, [&](fib::worker &) { return inner_result.get() + 1; });
+      fib::async(lone, [&](fib::worker &) { inner.set_value(1); }).get();
+      FIB_CHECK(outer.get() == 2);
+
+      // and a fiber woken by another pool's worker goes back to its own pool
+      fib::promise<int> across;
+      fib::future<int> across_result = across.get_future();
+      fib::future<bool> home = fib::async(lone, [&](fib::worker &) {
+        across_result.wait();
+        return &fib::worker::current()->p == &lone;
+      });
+      fib::async(p, [&](fib::worker &) {
+        fib::this_fiber::sleep_for(std::chrono::milliseconds(1));
+        across.set_value(1);
+      }).get();
+      FIB_CHECK(home.get());
+    }
+
+    // and inside the pool, where the worker's timing wheel keeps the time, including when completion races the deadline
+    {
+      fib::promise<int> never;
+      fib::future<int> nothing = never.get_future();
+      fib::future<bool> gave_up = fib::async(p, [&](fib::worker &) {
+        fib::chrono::clock::time_point start = fib::chrono::clock::now();
+        bool timed_out = nothing.wait_for(std::chrono::milliseconds(2)) == std::future_status::timeout;
+        return timed_out && fib::chrono::clock::now() - start >= std::chrono::milliseconds(2);
+      });
+      FIB_CHECK(gave_up.get());
+      never.set_value(0);
+
+      std::vector<fib::promise<int>> ps(200);
+      std::vector<fib::future<int>> fs;
+      for (fib::promise<int> & q : ps) fs.push_back(q.get_future());
+      std::vector<fib::future<int>> results;
+      for (int i = 0; i < 200; ++i) results.push_back(fib::async(p, [&fs, i](fib::worker &) {
+        if (fs[std::size_t(i)].wait_for(std::chrono::microseconds(50 + 5 * i)) == std::future_status::timeout) fs[std::size_t(i)].wait();
+        return fs[std::size_t(i)].get();
+      }));
+      for (int i = 0; i < 200; ++i) {
+        ps[std::size_t(i)].set_value(i);
+        if (i % 20 == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      for (int i = 0; i < 200; ++i) FIB_CHECK(results[std::size_t(i)].get() == i);
+    }
+
+    // nested async from inside a task
+    {
+      fib::future<int> f = fib::async(p, [](fib::worker & w) {
+        std::vector<fib::future<int>> parts;
+        for (int i = 0; i < 10; ++i) parts.push_back(fib::async(w, [i](fib::worker &) { return i; }));
+        int sum = 0;
+        for (fib::future<int> & x : parts) sum += x.get();
+        return sum;
+      });
+      FIB_CHECK(f.get() == 45);
+    }
+
+    // when_all over a range and over a pack, including an empty range
+    {
+      std::vector<fib::future<int>> fs;
+      for (int i = 0; i < 100; ++i) fs.push_back(fib::async(p, [i](fib::worker &) { return i; }));
+      std::vector<fib::future<int>> all = fib::when_all(fs.begin(), fs.end()).get();
+      FIB_CHECK(all.size() == 100);
+      for (int i = 0; i < 100; ++i) FIB_CHECK(all[std::size_t(i)].get() == i);
+
+      std::vector<fib::future<int>> none;
+      FIB_CHECK(fib::when_all(none.begin(), none.end()).get().empty());
+
+      std::tuple<fib::future<int>, fib::future<std::string>> both =
+        fib::when_all(fib::async(p, [](fib::worker &) { return 1; }), fib::make_ready_future(std::string("two"))).get();
+      FIB_CHECK(std::get<0>(both).get() == 1);
+      FIB_CHECK(std::get<1>(both).get() == "two");
+    }
+
+    // when_any picks the first to be ready, and leaves the rest to finish on their own
+    {
+      fib::promise<int> never;
+      std::vector<fib::future<int>> fs;
+      fs.push_back(never.get_future());
+      fs.push_back(fib::async(p, [](fib::worker &) { return 7; }));
+      std::pair<std::size_t, fib::future<int>> first = fib::when_any(fs.begin(), fs.end()).get();
+      FIB_CHECK(first.first == 1);
+      FIB_CHECK(first.second.get() == 7);
+      never.set_value(0);
+
+      std::vector<fib::future<int>> none;
+      FIB_CHECK(fails_with(std::future_errc::no_state, [&] { fib::when_any(none.begin(), none.end()).get(); }));
+    }
+
+    survivor = fib::async(p, [](fib::worker &) { return 5; });
+    survivor.wait();
+  }
+  // futures outlive their pool
+  FIB_CHECK(survivor.get() == 5);
+}
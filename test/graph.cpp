@@ -0,0 +1,173 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+// count allocations, to check that running a built graph makes none
+namespace {
+  std::atomic<long> allocations(0);
+}
+
+void * operator new(std::size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void * p = std::malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+  const int layers = 20, width = 8;
+
+  /// layers of nodes, each depending on two in the layer before, stamping the order they run in
+  struct lattice {
+    fib::graph g;
+    std::vector<int> stamps;
+    std::atomic<int> clock;
+
+    lattice() : stamps(layers * width, 0), clock(0) {
+      for (int l = 0; l < layers; ++l)
+        for (int i = 0; i < width; ++i) {
+          fib::graph::node n = g.emplace([this, l, i](fib::worker &) {
+            stamps[std::size_t(l * width + i)] = clock.fetch_add(1) + 1;
+          });
+          FIB_CHECK(n == fib::graph::node(l * width + i));
+          if (l > 0) {
+            g.precede(std::size_t((l - 1) * width + i), n);
+            g.precede(std::size_t((l - 1) * width + (i + 1) % width), n);
+          }
+        }
+    }
+
+    /// did every node run once, after both of its predecessors?
+    bool ordered() const {
+      if (clock.load() != layers * width) return false;
+      for (int l = 1; l < layers; ++l)
+        for (int i = 0; i < width; ++i) {
+          int s = stamps[std::size_t(l * width + i)];
+          if (s <= stamps[std::size_t((l - 1) * width + i)] || s <= stamps[std::size_t((l - 1) * width + (i + 1) % width)]) return false;
+        }
+      return true;
+    }
+
+    void run(fib::pool & p) {
+      clock.store(0);
+      g.run(p);
+      FIB_CHECK(g.done());
+      FIB_CHECK(ordered());
+    }
+  };
+}
+
+int main() {
+  std::mt19937 rng(1);
+  fib::pool p(4, rng);
+
+  // dependencies are respected, run after run, and reruns allocate nothing
+  {
+    lattice l;
+    l.run(p);
+    l.run(p);
+    long before = allocations.load();
+    for (int r = 0; r < 10; ++r) l.run(p);
+    FIB_CHECK(allocations.load() == before);
+  }
+
+  // the waiter may free the graph the moment the run completes, while the last node is still being cleaned up
+  for (int r = 0; r < 2000; ++r) {
+    std::unique_ptr<fib::graph> g(new fib::graph);
+    std::atomic<int> count(0);
+    fib::graph::node a = g->emplace([&](fib::worker &) { count.fetch_add(1); });
+    fib::graph::node b = g->emplace([&](fib::worker &) { count.fetch_add(1); });
+    fib::graph::node c = g->emplace([&](fib::worker &) { count.fetch_add(1); });
+    fib::graph::node d = g->emplace([&](fib::worker &) { count.fetch_add(1); });
+    g->precede(a, b);
+    g->precede(a, c);
+    g->precede(b, d);
+    g->precede(c, d);
+    g->run(p);
+    FIB_CHECK(count.load() == 4);
+  }
+
+  // run from inside a task, where waiting suspends the fiber: even a lone worker gets through
+  {
+    fib::pool lone(1, rng);
+    lattice l;
+    fib::async(lone, [&](fib::worker &) {
+      l.run(lone);
+      l.run(lone);
+    }).get();
+    fib::async(p, [&](fib::worker &) { l.run(p); }).get();
+  }
+
+  // one run at a time
+  {
+    fib::graph g;
+    std::atomic<bool> go(false);
+    g.emplace([&](fib::worker &) { while (!go.load()) fib::this_fiber::yield(); });
+    g.start(p);
+    FIB_CHECK(!g.done());
+    bool threw = false;
+    try { g.start(p); } catch (std::logic_error &) { threw = true; }
+    FIB_CHECK(threw);
+    go.store(true);
+    g.wait();
+    FIB_CHECK(g.done());
+  }
+
+  // a pool shutting down mid-run drops what it hasn't run, along with everything behind it, and the waiter still wakes
+  {
+    fib::graph g;
+    std::atomic<int> count(0);
+    fib::graph::node last = g.emplace([&](fib::worker &) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      count.fetch_add(1);
+    });
+    for (int i = 0; i < 100; ++i) {
+      fib::graph::node n = g.emplace([&](fib::worker &) { count.fetch_add(1); });
+      g.precede(last, n);
+      last = n;
+    }
+    {
+      fib::pool doomed(1, rng);
+      g.start(doomed);
+    }
+    g.wait();
+    FIB_CHECK(g.done());
+    FIB_CHECK(count.load() < 101);
+  }
+
+  // nodes at their own priorities, and the edge cases
+  {
+    fib::graph g;
+    std::atomic<int> level(-1);
+    g.emplace([&](fib::worker & w) { level.store(int(w.level)); }, fib::priority::high);
+    g.run(p);
+    FIB_CHECK(level.load() == int(fib::priority::high));
+
+    fib::graph empty;
+    empty.run(p);
+    FIB_CHECK(empty.done() && empty.size() == 0);
+
+    bool threw = false;
+    try { g.precede(0, 1); } catch (std::out_of_range &) { threw = true; }
+    FIB_CHECK(threw);
+
+    fib::graph cycle;
+    fib::graph::node a = cycle.emplace([](fib::worker &) {}), b = cycle.emplace([](fib::worker &) {});
+    cycle.precede(a, b);
+    cycle.precede(b, a);
+    threw = false;
+    try { cycle.run(p); } catch (std::logic_error &) { threw = true; }
+    FIB_CHECK(threw);
+    FIB_CHECK(cycle.done());
+  }
+}
@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  const char * const text_path = "test_mapped_lines.txt";
+  const char * const records_path = "test_mapped_records.bin";
+  const char * const empty_path = "test_mapped_empty";
+  const int line_count = 20000, record_count = 10000;
+
+  // line i is its number followed by i % 37 x's. the last has no newline
+  std::string line(int i) {
+    return std::to_string(i) + std::string(std::size_t(i % 37), 'x');
+  }
+
+  void write_files() {
+    {
+      std::ofstream out(text_path, std::ios::binary);
+      for (int i = 0; i < line_count; ++i) out << line(i) << (i + 1 < line_count ? "\n" : "");
+    }
+    {
+      std::ofstream out(records_path, std::ios::binary);
+      for (std::uint32_t i = 0; i < std::uint32_t(record_count); ++i) {
+        std::uint32_t n = i % 300;
+        out.write(reinterpret_cast<const char *>(&n), sizeof n);
+        for (std::uint32_t k = 0; k < n; ++k) out.put(char(i));
+      }
+    }
+    std::ofstream empty(empty_path);
+  }
+}
+
+int main() {
+  write_files();
+
+  // every line, in order, without newlines, including a last one without one
+  fib::mapped_file text(text_path);
+  FIB_CHECK(text.is_open());
+  {
+    int i = 0;
+    fib::lines(text).foreach([&](fib::slice s) {
+      FIB_CHECK(s == fib::slice(line(i).data(), line(i).size()));
+      ++i;
+    });
+    FIB_CHECK(i == line_count);
+  }
+
+  // cut anywhere, between them the ranges see every line exactly once, and every whole record
+  for (std::size_t parts : { 1, 2, 3, 7, 64, 1000 }) {
+    std::vector<fib::byte_range> ranges = fib::mapped_file::split(text.all(), parts);
+    FIB_CHECK(ranges.size() == parts);
+    FIB_CHECK(ranges.front().first == 0 && ranges.back().last == text.size());
+    int i = 0;
+    std::size_t records = 0;
+    for (std::size_t k = 0; k < ranges.size(); ++k) {
+      if (k > 0) FIB_CHECK(ranges[k].first == ranges[k - 1].last);
+      fib::lines(text, ranges[k]).foreach([&](fib::slice s) {
+        FIB_CHECK(s.str() == line(i));
+        ++i;
+      });
+      fib::records(text, 16, ranges[k]).foreach([&](fib::slice s) {
+        FIB_CHECK(s.size() == 16 && s.data() == text.data() + 16 * records);
+        ++records;
+      });
+    }
+    FIB_CHECK(i == line_count);
+    FIB_CHECK(records == text.size() / 16);
+  }
+
+  // length prefixed records, whole and split on record boundaries
+  fib::mapped_file records(records_path);
+  {
+    std::uint32_t i = 0;
+    fib::prefixed_records(records).foreach([&](fib::slice s) {
+      FIB_CHECK(s.size() == i % 300);
+      FIB_CHECK(s.empty() || (s[0] == char(i) && s[s.size() - 1] == char(i)));
+      ++i;
+    });
+    FIB_CHECK(i == std::uint32_t(record_count));
+    for (std::size_t parts : { 1, 4, 16 }) {
+      std::uint32_t j = 0;
+      for (fib::byte_range r : fib::split_prefixed(records, parts))
+        fib::prefixed_records(records, r).foreach([&](fib::slice s) { FIB_CHECK(s.size() == j++ % 300); });
+      FIB_CHECK(j == std::uint32_t(record_count));
+    }
+  }
+
+  // the edges
+  {
+    fib::mapped_file empty(empty_path);
+    int n = 0;
+    fib::lines(empty).foreach([&](fib::slice) { ++n; });
+    fib::records(empty, 4).foreach([&](fib::slice) { ++n; });
+    fib::prefixed_records(empty).foreach([&](fib::slice) { ++n; });
+    FIB_CHECK(n == 0);
+
+    FIB_CHECK(text.bytes(fib::byte_range { text.size() - 4, text.size() + 100 }).str() == line(line_count - 1).substr(line(line_count - 1).size() - 4));
+    FIB_CHECK(text.bytes(fib::byte_range { text.size() + 1, text.size() + 2 }).empty());
+
+    bool threw = false;
+    try { fib::records(text, 0); } catch (std::invalid_argument &) { threw = true; }
+    FIB_CHECK(threw);
+
+    // a length running off the end of the file
+    threw = false;
+    try { fib::prefixed_records(text).foreach([](fib::slice) {}); } catch (std::runtime_error &) { threw = true; }
+    FIB_CHECK(threw);
+
+    threw = false;
+    try { fib::mapped_file missing("/nonexistent/file"); } catch (std::system_error &) { threw = true; }
+    FIB_CHECK(threw);
+
+    fib::mapped_file moved(std::move(text));
+    FIB_CHECK(moved.is_open() && !text.is_open());
+    text = std::move(moved);
+  }
+
+  // split across a pool, composed with the other enumerators
+  {
+    std::mt19937 rng(1);
+    fib::pool p(4, rng);
+    fib::sharded_counter longer;
+    std::vector<fib::byte_range> ranges = fib::mapped_file::split(text.all(), 16);
+    fib::latch joined(std::ptrdiff_t(ranges.size()));
+    for (fib::byte_range r : ranges) p.submit([&, r](fib::worker &) {
+      fib::lines(text, r).where([](fib::slice s) { return s.size() > 10; }).foreach([&](fib::slice) { ++longer; });
+      joined.count_down();
+    });
+    joined.wait();
+    long expected = 0;
+    for (int i = 0; i < line_count; ++i) if (line(i).size() > 10) ++expected;
+    FIB_CHECK(longer.value() == expected);
+  }
+
+  std::remove(text_path);
+  std::remove(records_path);
+  std::remove(empty_path);
+}
@@ -0,0 +1,80 @@
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "fib.h"
+#include "check.h"
+
+using fib::memory::per_worker;
+using fib::memory::hardware_destructive_interference_size;
+
+namespace {
+  struct big {
+    char bytes[3 * hardware_destructive_interference_size / 2];
+  };
+
+  struct alignas(256) overaligned {
+    int x = 0;
+  };
+
+  std::atomic<int> live(0);
+
+  struct fragile {
+    explicit fragile(int fail_at) {
+      if (live.load() == fail_at) throw std::runtime_error("no");
+      live.fetch_add(1);
+    }
+    ~fragile() { live.fetch_sub(1); }
+  };
+
+  template <typename T> std::uintptr_t address(per_worker<T> & v, std::size_t i) {
+    return reinterpret_cast<std::uintptr_t>(&v[i]);
+  }
+}
+
+int main() {
+  // every slot starts its own run of cache lines, whatever the size or alignment of T
+  {
+    per_worker<char> small(5, 'x');
+    per_worker<big> large(5);
+    per_worker<overaligned> wide(5);
+    for (std::size_t i = 0; i < 5; ++i) {
+      FIB_CHECK(small[i] == 'x');
+      FIB_CHECK(address(small, i) % hardware_destructive_interference_size == 0);
+      FIB_CHECK(address(large, i) % hardware_destructive_interference_size == 0);
+      FIB_CHECK(address(wide, i) % 256 == 0);
+      if (i > 0) {
+        FIB_CHECK(address(small, i) - address(small, i - 1) == hardware_destructive_interference_size);
+        FIB_CHECK(address(large, i) - address(large, i - 1) >= sizeof(big));
+      }
+    }
+  }
+
+  // a constructor that throws part way leaves nothing behind
+  {
+    bool threw = false;
+    try { per_worker<fragile> v(8, 3); } catch (std::runtime_error &) { threw = true; }
+    FIB_CHECK(threw);
+    FIB_CHECK(live.load() == 0);
+    { per_worker<fragile> v(8, -1); FIB_CHECK(live.load() == 8); }
+    FIB_CHECK(live.load() == 0);
+  }
+
+  // sized to a pool, and indexed by the current worker
+  {
+    std::mt19937 rng(1);
+    fib::pool p(3, rng);
+    per_worker<std::string> names(p);
+    FIB_CHECK(names.size() == 3);
+    fib::latch joined(100);
+    for (int i = 0; i < 100; ++i) p.submit([&](fib::worker & w) {
+      names.local() = "worker " + std::to_string(w.id);
+      FIB_CHECK(&names.local() == &names[w]);
+      joined.count_down();
+    });
+    joined.wait();
+    for (std::size_t i = 0; i < names.size(); ++i) FIB_CHECK(names[i].empty() || names[i] == "worker " + std::to_string(i));
+  }
+}
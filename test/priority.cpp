@@ -0,0 +1,62 @@
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+// a single worker, so the order tasks run in is the order it takes them in
+
+namespace {
+  std::vector<int> order;
+  std::atomic<bool> done(false);
+
+  void wait_done() {
+    while (!done.load()) std::this_thread::yield();
+    done.store(false);
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+
+  // most urgent first, and children inherit their parent's class
+  order.clear();
+  {
+    fib::pool p(1, rng, [](fib::worker & w) {
+      w.spawn(fib::priority::low, [](fib::worker &) {
+        order.push_back(3);
+        done.store(true);
+      });
+      w.spawn(fib::priority::normal, [](fib::worker &) { order.push_back(2); });
+      w.spawn(fib::priority::high, [](fib::worker & w) {
+        order.push_back(0);
+        FIB_CHECK(w.level == fib::priority::high);
+        w.spawn([](fib::worker & w) {
+          FIB_CHECK(w.level == fib::priority::high);
+          order.push_back(1);
+        });
+      });
+    });
+    wait_done();
+  }
+  FIB_CHECK(order == std::vector<int>({ 0, 1, 2, 3 }));
+
+  // but a starved class gets a turn before the urgent work runs out
+  order.clear();
+  {
+    fib::pool p(1, rng, [](fib::worker & w) {
+      // queues run newest first, so the last of these runs first
+      w.spawn(fib::priority::low, [](fib::worker &) { done.store(true); });
+      w.spawn(fib::priority::low, [](fib::worker &) { order.push_back(-1); });
+      for (int i = 0; i < 4 * fib::worker::starvation_limit; ++i)
+        w.spawn(fib::priority::high, [i](fib::worker &) { order.push_back(i); });
+    });
+    wait_done();
+  }
+  std::size_t low = 0;
+  while (low < order.size() && order[low] != -1) ++low;
+  FIB_CHECK(low < order.size());
+  FIB_CHECK(low <= std::size_t(fib::worker::starvation_limit) + 1);
+}
@@ -0,0 +1,102 @@
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+using fib::xoshiro256;
+
+int main() {
+  static_assert(xoshiro256::min() == 0 && xoshiro256::max() == ~std::uint64_t(0), "full range");
+  static_assert(std::is_copy_constructible<xoshiro256>::value, "copyable");
+
+  // deterministic per seed, and copies carry on identically, including copies of non-const generators
+  {
+    xoshiro256 a(42), b(42), c(43);
+    std::uint64_t x = a();
+    FIB_CHECK(x == b());
+    FIB_CHECK(x != c());
+    xoshiro256 d(a);
+    const xoshiro256 & ca = a;
+    xoshiro256 e(ca);
+    for (int i = 0; i < 100; ++i) {
+      std::uint64_t v = a();
+      FIB_CHECK(d() == v && e() == v);
+    }
+    xoshiro256 zero(0);
+    bool moved = false;
+    for (int i = 0; i < 4; ++i) moved |= zero() != 0;
+    FIB_CHECK(moved);
+  }
+
+  // seeded from a seed sequence
+  {
+    std::seed_seq s1 { 1, 2, 3 }, s2 { 1, 2, 3 }, s3 { 3, 2, 1 };
+    xoshiro256 a(s1), b(s2), c(s3);
+    std::uint64_t x = a();
+    FIB_CHECK(x == b());
+    FIB_CHECK(x != c());
+  }
+
+  // below stays in range and hits every value about equally often
+  {
+    xoshiro256 g(7);
+    const std::uint32_t n = 10;
+    const int draws = 100000;
+    std::vector<int> hits(n, 0);
+    for (int i = 0; i < draws; ++i) {
+      std::uint32_t k = g.below(n);
+      FIB_CHECK(k < n);
+      ++hits[k];
+    }
+    for (int h : hits) FIB_CHECK(h > draws / int(n) * 9 / 10 && h < draws / int(n) * 11 / 10);
+    FIB_CHECK(g.below(1) == 0);
+  }
+
+  // exponential has mean about 1, and works with the standard distributions too
+  {
+    xoshiro256 g(9);
+    double sum = 0;
+    const int draws = 100000;
+    for (int i = 0; i < draws; ++i) {
+      float x = g.exponential();
+      FIB_CHECK(x >= 0);
+      sum += x;
+    }
+    FIB_CHECK(sum / draws > 0.95 && sum / draws < 1.05);
+    for (int i = 0; i < 256; ++i) FIB_CHECK(std::fabs(fib::detail::unit_exponential[i] + std::log((i + 0.5) / 256)) < 1e-5);
+
+    std::uniform_int_distribution<int> die(1, 6);
+    for (int i = 0; i < 1000; ++i) {
+      int r = die(g);
+      FIB_CHECK(r >= 1 && r <= 6);
+    }
+  }
+
+  // every victim policy gets the work done, and shares it around
+  for (fib::victim_policy policy : { fib::victim_policy::random, fib::victim_policy::round_robin, fib::victim_policy::power_of_two }) {
+    std::mt19937 rng(1);
+    fib::pool p(4, rng);
+    p.victims.store(policy);
+    const long tasks = 2000;
+    std::atomic<long> done(0);
+    std::atomic<long> ran[4];
+    for (std::atomic<long> & r : ran) r.store(0);
+    p.submit([&](fib::worker & w) {
+      for (long i = 0; i < tasks; ++i) w.spawn([&](fib::worker & v) {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        ran[v.id].fetch_add(1);
+        done.fetch_add(1);
+      });
+    });
+    while (done.load() < tasks) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    int used = 0;
+    for (std::atomic<long> & r : ran) used += r.load() > 0;
+    FIB_CHECK(used > 1);
+  }
+}
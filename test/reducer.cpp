@@ -0,0 +1,72 @@
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  const int tasks = 1000;
+
+  // run @p f for each of [0, tasks) across @p p, and wait for all of them
+  template <typename F> void parallel_for(fib::pool & p, F f) {
+    fib::latch joined(tasks);
+    for (int i = 0; i < tasks; ++i) p.submit([&, i](fib::worker &) {
+      f(i);
+      fib::this_fiber::yield(); // and maybe come back elsewhere
+      joined.count_down();
+    });
+    joined.wait();
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  fib::pool p(4, rng), q(3, rng);
+
+  // every update lands in exactly one view
+  {
+    fib::reducer<long> sum;
+    fib::reducer<int, fib::monoid::min<int>> least(fib::monoid::min<int>(1 << 30));
+    fib::reducer<int, fib::monoid::max<int>> most(fib::monoid::max<int>(-1));
+    parallel_for(p, [&](int i) {
+      sum.update(i);
+      sum.local() += 1;
+      least.update(i + 5);
+      most.update(i);
+    });
+    sum.update(1000000); // from outside the pool
+    FIB_CHECK(sum.get() == long(tasks) * (tasks - 1) / 2 + tasks + 1000000);
+    FIB_CHECK(least.get() == 5);
+    FIB_CHECK(most.get() == tasks - 1);
+
+    // take leaves the identity behind
+    FIB_CHECK(sum.take() == long(tasks) * (tasks - 1) / 2 + tasks + 1000000);
+    FIB_CHECK(sum.get() == 0);
+    parallel_for(p, [&](int) { sum.update(2); });
+    FIB_CHECK(sum.get() == 2 * tasks);
+    sum.clear();
+    FIB_CHECK(sum.get() == 0);
+  }
+
+  // a counter shared by two pools, whose workers share ids, and by threads outside of both, loses nothing
+  {
+    fib::sharded_counter counter;
+    const int rounds = 200;
+    std::thread outside([&] {
+      for (int i = 0; i < tasks * rounds; ++i) ++counter;
+    });
+    std::thread other([&] {
+      parallel_for(q, [&](int) {
+        for (int i = 0; i < rounds; ++i) counter += 1;
+      });
+    });
+    parallel_for(p, [&](int) {
+      for (int i = 0; i < rounds; ++i) counter.add();
+    });
+    other.join();
+    outside.join();
+    FIB_CHECK(counter.value() == 3L * tasks * rounds);
+  }
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::atomic<long> done(0);
+  std::atomic<int> highest(-1);
+
+  void note_worker(const fib::worker & w) {
+    int id = w.id, seen = highest.load();
+    while (id > seen && !highest.compare_exchange_weak(seen, id)) {}
+  }
+
+  void spin(std::chrono::microseconds t) {
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now() + t;
+    while (std::chrono::steady_clock::now() < stop) {}
+  }
+
+  void tree(fib::worker & w, int depth) {
+    note_worker(w);
+    if (depth == 0) {
+      spin(std::chrono::microseconds(50));
+      done.fetch_add(1);
+      return;
+    }
+    w.spawn([depth](fib::worker & v) { tree(v, depth - 1); });
+    w.spawn([depth](fib::worker & v) { tree(v, depth - 1); });
+  }
+
+  void run_tree(fib::pool & p, int depth) {
+    done.store(0);
+    p.submit([depth](fib::worker & w) { tree(w, depth); });
+    while (done.load() < 1L << depth) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // poll @p pred for up to @p limit
+  template <typename P> bool eventually(P pred, std::chrono::milliseconds limit = std::chrono::milliseconds(5000)) {
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now() + limit;
+    while (!pred()) {
+      if (std::chrono::steady_clock::now() > stop) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+
+  // only active workers run anything, and sizes are clamped
+  {
+    fib::pool p(8, 2, rng);
+    FIB_CHECK(p.active() == 2);
+    run_tree(p, 10);
+    FIB_CHECK(highest.load() < 2);
+
+    p.resize(100);
+    FIB_CHECK(p.active() == 8);
+    highest.store(-1);
+    run_tree(p, 12);
+    FIB_CHECK(highest.load() >= 0);
+
+    // retired workers pass their work back, and take no more
+    p.resize(0);
+    FIB_CHECK(p.active() == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    highest.store(-1);
+    run_tree(p, 10);
+    FIB_CHECK(highest.load() == 0);
+  }
+
+  // fibers asleep on workers that retire still wake
+  {
+    fib::pool p(8, rng);
+    std::atomic<int> woke(0);
+    for (int i = 0; i < 64; ++i) p.submit([&](fib::worker &) {
+      fib::this_fiber::sleep_for(std::chrono::milliseconds(20));
+      woke.fetch_add(1);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    p.resize(1);
+    FIB_CHECK(eventually([&] { return woke.load() == 64; }));
+  }
+
+  // autoscaling grows a pool under load and shrinks it back to its floor once idle
+  {
+    fib::pool p(8, 1, rng);
+    p.autoscale(fib::scaling_policy(1, std::chrono::milliseconds(5)));
+    int peak = 1;
+    done.store(0);
+    p.submit([](fib::worker & w) { tree(w, 14); });
+    while (done.load() < 1L << 14) {
+      peak = std::max(peak, p.active());
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    FIB_CHECK(peak > 1);
+    FIB_CHECK(eventually([&] { return p.active() == 1; }));
+    p.stop_autoscaling();
+    p.resize(3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    FIB_CHECK(p.active() == 3);
+  }
+}
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::atomic<long> done(0);
+
+  struct bump {
+    void operator()(fib::worker &) const { done.fetch_add(1, std::memory_order_relaxed); }
+  };
+
+  void wait_for(long n) {
+    while (done.load() < n) std::this_thread::yield();
+    FIB_CHECK(done.load() == n);
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  fib::pool p(2, rng);
+
+  // many outside threads at once, one task at a time and in bulk, in chunks and out of them
+  {
+    const int submitters = 4, singles = 5000;
+    const std::size_t bulk = 3 * fib::pool::bulk_chunk + 7;
+    std::vector<std::thread> ts;
+    for (int t = 0; t < submitters; ++t) ts.emplace_back([&] {
+      for (int i = 0; i < singles; ++i) p.submit(bump());
+      std::vector<bump> batch(bulk);
+      p.submit_bulk(batch.begin(), batch.end(), fib::priority::low);
+    });
+    for (std::thread & t : ts) t.join();
+    wait_for(submitters * (singles + long(bulk)));
+  }
+
+  // workers that ran out of work and parked are woken by a submission
+  done.store(0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  p.submit(bump(), fib::priority::high);
+  wait_for(1);
+
+  // from inside the pool too
+  done.store(0);
+  p.submit([&p](fib::worker &) {
+    std::vector<bump> batch(10);
+    p.submit_bulk(batch.begin(), batch.end());
+  });
+  wait_for(10);
+
+  // from a worker of another pool, which may be gone by the time the task runs and is freed
+  done.store(0);
+  {
+    std::atomic<bool> gone(false), sent(false);
+    {
+      fib::pool q(1, rng);
+      q.submit([&](fib::worker &) {
+        p.submit([&](fib::worker &) {
+          while (!gone.load()) std::this_thread::yield();
+          done.fetch_add(1);
+        });
+        sent.store(true);
+      });
+      while (!sent.load()) std::this_thread::yield();
+    }
+    gone.store(true);
+    wait_for(1);
+  }
+
+  // an empty batch is fine
+  std::vector<bump> none;
+  p.submit_bulk(none.begin(), none.end());
+}
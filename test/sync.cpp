@@ -0,0 +1,202 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::atomic<long> done(0);
+
+  void wait_for(long n) {
+    while (done.load() < n) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    done.store(0);
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  fib::pool p(4, rng);
+
+  // mutex: no lost updates, even when holders suspend inside the critical section
+  {
+    fib::mutex m;
+    long counter = 0;
+    const int fibers = 500, rounds = 100;
+    for (int f = 0; f < fibers; ++f) p.submit([&](fib::worker &) {
+      for (int i = 0; i < rounds; ++i) {
+        std::lock_guard<fib::mutex> guard(m);
+        long c = counter;
+        if (i % 25 == 0) fib::this_fiber::yield();
+        counter = c + 1;
+      }
+      done.fetch_add(1);
+    });
+    wait_for(fibers);
+    FIB_CHECK(counter == long(fibers) * rounds);
+    FIB_CHECK(m.try_lock());
+    m.unlock();
+  }
+
+  // condition_variable: a hand off between fibers and a thread outside the pool
+  {
+    fib::mutex m;
+    fib::condition_variable cv;
+    int stage = 0;
+    std::thread outside([&] {
+      std::unique_lock<fib::mutex> lock(m);
+      cv.wait(lock, [&] { return stage == 2; });
+      stage = 3;
+      cv.notify_all();
+    });
+    p.submit([&](fib::worker &) {
+      std::unique_lock<fib::mutex> lock(m);
+      cv.wait(lock, [&] { return stage == 1; });
+      stage = 2;
+      cv.notify_all();
+      cv.wait(lock, [&] { return stage == 3; });
+      done.fetch_add(1);
+    });
+    p.submit([&](fib::worker &) {
+      fib::this_fiber::sleep_for(std::chrono::milliseconds(5));
+      std::lock_guard<fib::mutex> lock(m);
+      stage = 1;
+      cv.notify_all();
+    });
+    wait_for(1);
+    outside.join();
+    FIB_CHECK(stage == 3);
+  }
+
+  // semaphore: never more holders than units
+  {
+    fib::semaphore s(3);
+    std::atomic<int> inside(0), peak(0);
+    for (int f = 0; f < 100; ++f) p.submit([&](fib::worker &) {
+      s.acquire();
+      int k = inside.fetch_add(1) + 1, seen = peak.load();
+      while (k > seen && !peak.compare_exchange_weak(seen, k)) {}
+      fib::this_fiber::sleep_for(std::chrono::microseconds(200));
+      inside.fetch_sub(1);
+      s.release();
+      done.fetch_add(1);
+    });
+    wait_for(100);
+    FIB_CHECK(peak.load() >= 1 && peak.load() <= 3);
+    FIB_CHECK(s.try_acquire() && s.try_acquire() && s.try_acquire());
+    FIB_CHECK(!s.try_acquire());
+  }
+
+  // a fiber woken by a worker of another pool goes back to its own
+  {
+    fib::pool q(2, rng);
+    fib::semaphore s(0);
+    std::atomic<int> home(0);
+    for (int f = 0; f < 50; ++f) q.submit([&](fib::worker &) {
+      s.acquire();
+      if (&fib::worker::current()->p == &q) home.fetch_add(1);
+      done.fetch_add(1);
+    });
+    for (int f = 0; f < 50; ++f) p.submit([&](fib::worker &) { s.release(); });
+    wait_for(50);
+    FIB_CHECK(home.load() == 50);
+  }
+
+  // timed waits give up at their deadline, on fibers and on threads outside the pool, and succeed if served in time
+  {
+    fib::mutex m;
+    fib::condition_variable cv;
+    fib::semaphore s(0);
+    fib::latch l(1);
+    const std::chrono::milliseconds delay(2);
+    auto timeouts = [&] {
+      fib::chrono::clock::time_point start = fib::chrono::clock::now();
+      FIB_CHECK(!s.try_acquire_for(delay));
+      FIB_CHECK(!l.wait_for(delay));
+      {
+        std::unique_lock<fib::mutex> lock(m);
+        FIB_CHECK(cv.wait_for(lock, delay) == std::cv_status::timeout);
+        FIB_CHECK(!cv.wait_for(lock, delay, [] { return false; }));
+      }
+      FIB_CHECK(fib::chrono::clock::now() - start >= 4 * delay);
+    };
+    timeouts();
+    p.submit([&](fib::worker &) {
+      timeouts();
+      done.fetch_add(1);
+    });
+    wait_for(1);
+    m.lock();
+    p.submit([&](fib::worker &) {
+      FIB_CHECK(!m.try_lock_for(delay));
+      done.fetch_add(1);
+    });
+    wait_for(1);
+    m.unlock();
+
+    // served in time
+    bool flag = false;
+    p.submit([&](fib::worker &) {
+      FIB_CHECK(s.try_acquire_for(std::chrono::seconds(10)));
+      FIB_CHECK(l.wait_for(std::chrono::seconds(10)));
+      std::unique_lock<fib::mutex> lock(m);
+      FIB_CHECK(cv.wait_for(lock, std::chrono::seconds(10), [&] { return flag; }));
+      done.fetch_add(1);
+    });
+    std::this_thread::sleep_for(delay);
+    s.release();
+    l.count_down();
+    {
+      std::lock_guard<fib::mutex> lock(m);
+      flag = true;
+    }
+    cv.notify_all();
+    wait_for(1);
+    FIB_CHECK(l.wait_for(delay));
+  }
+
+  // units are neither lost nor duplicated when releases race timeouts
+  {
+    fib::semaphore s(0);
+    std::atomic<int> acquired(0);
+    const int takers = 200;
+    for (int f = 0; f < takers; ++f) p.submit([&, f](fib::worker &) {
+      if (s.try_acquire_for(std::chrono::microseconds(100 + 10 * (f % 50)))) acquired.fetch_add(1);
+      done.fetch_add(1);
+    });
+    for (int i = 0; i < takers / 2; ++i) {
+      s.release();
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
+    wait_for(takers);
+    int left = 0;
+    while (s.try_acquire()) ++left;
+    FIB_CHECK(acquired.load() + left == takers / 2);
+  }
+
+  // barrier: nobody gets through a phase before everyone arrives, and each phase has one leader.
+  // latch: waited on from outside the pool
+  {
+    const int parties = 20, phases = 10;
+    fib::barrier b(parties);
+    fib::latch l(parties);
+    std::atomic<int> arrivals(0), leaders(0), early(0);
+    for (int f = 0; f < parties; ++f) p.submit([&](fib::worker &) {
+      for (int ph = 0; ph < phases; ++ph) {
+        arrivals.fetch_add(1);
+        if (b.arrive_and_wait()) leaders.fetch_add(1);
+        if (arrivals.load() < parties * (ph + 1)) early.fetch_add(1);
+        b.arrive_and_wait();
+      }
+      l.count_down();
+      done.fetch_add(1);
+    });
+    l.wait();
+    FIB_CHECK(l.try_wait());
+    wait_for(parties);
+    FIB_CHECK(early.load() == 0);
+    FIB_CHECK(leaders.load() == phases);
+  }
+}
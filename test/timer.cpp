@@ -0,0 +1,117 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  typedef fib::chrono::clock clock;
+
+  std::atomic<long> done(0), early(0), ran(0);
+
+  void wait_for(std::atomic<long> & counter, long n) {
+    while (counter.load() < n) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+
+  // timers across every level of the wheel fire, and never early
+  {
+    const long n = 2000;
+    fib::pool p(2, rng);
+    for (long i = 0; i < n; ++i) p.submit([i](fib::worker & w) {
+      std::chrono::microseconds delay((i * i * 7919) % 20000);
+      clock::time_point due = clock::now() + delay;
+      w.spawn_after(delay, [due](fib::worker &) {
+        if (clock::now() < due) early.fetch_add(1);
+        done.fetch_add(1);
+      });
+    });
+    wait_for(done, n);
+    FIB_CHECK(early.load() == 0);
+  }
+
+  // a cancelled timer never runs, one that already fired can't be cancelled, and revoke hands the work back
+  done.store(0);
+  {
+    fib::pool p(2, rng);
+    std::atomic<bool> checked(false);
+    p.submit([&](fib::worker & w) {
+      fib::timer never = w.spawn_after(std::chrono::milliseconds(20), [](fib::worker &) { ran.fetch_add(1); });
+      FIB_CHECK(never.pending());
+      FIB_CHECK(never.cancel());
+      FIB_CHECK(!never.pending());
+      FIB_CHECK(!never.cancel());
+
+      fib::timer back = w.spawn_after(std::chrono::milliseconds(20), [](fib::worker &) { done.fetch_add(1); });
+      fib::task t = back.revoke();
+      FIB_CHECK(bool(t));
+      FIB_CHECK(!back.pending());
+      w.schedule(std::move(t));
+
+      fib::timer soon = w.spawn_after(std::chrono::microseconds(100), [](fib::worker &) { done.fetch_add(1); });
+      fib::this_fiber::sleep_for(std::chrono::milliseconds(5));
+      FIB_CHECK(!soon.pending());
+      FIB_CHECK(!soon.cancel());
+      checked.store(true);
+    });
+    wait_for(done, 2);
+    while (!checked.load()) std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    FIB_CHECK(ran.load() == 0);
+  }
+
+  // sleeping suspends just the fiber: the worker runs other work meanwhile, and the sleeper wakes on time
+  done.store(0);
+  {
+    fib::pool p(1, rng);
+    std::atomic<long> order(0), woke(-1), other(-1);
+    p.submit([&](fib::worker &) {
+      clock::time_point start = clock::now();
+      fib::this_fiber::sleep_for(std::chrono::milliseconds(10));
+      FIB_CHECK(clock::now() - start >= std::chrono::milliseconds(10));
+      woke.store(order.fetch_add(1));
+      done.fetch_add(1);
+    });
+    p.submit([&](fib::worker &) {
+      other.store(order.fetch_add(1));
+      done.fetch_add(1);
+    });
+    wait_for(done, 2);
+    FIB_CHECK(other.load() == 0);
+    FIB_CHECK(woke.load() == 1);
+  }
+
+  // handles may outlive their pool, whose shutdown cancels whatever is still pending, sleeping fibers included
+  ran.store(0);
+  {
+    fib::timer late;
+    {
+      fib::pool p(2, rng);
+      std::atomic<bool> armed(false);
+      p.submit([&](fib::worker & w) {
+        late = w.spawn_after(std::chrono::seconds(100), [](fib::worker &) { ran.fetch_add(1); });
+        armed.store(true);
+      });
+      for (int i = 0; i < 10; ++i) p.submit([](fib::worker &) {
+        fib::this_fiber::sleep_for(std::chrono::seconds(100));
+        ran.fetch_add(1);
+      });
+      while (!armed.load()) std::this_thread::yield();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    FIB_CHECK(!late.pending());
+    FIB_CHECK(!late.cancel());
+  }
+  FIB_CHECK(ran.load() == 0);
+
+  // and outside a pool, sleeping just sleeps the thread
+  clock::time_point start = clock::now();
+  fib::this_fiber::sleep_for(std::chrono::milliseconds(2));
+  FIB_CHECK(clock::now() - start >= std::chrono::milliseconds(2));
+}
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+// the hooks only record with ENABLE_TRACE. without it, dumps are just empty timelines
+
+namespace {
+  std::string dump() {
+    std::ostringstream out;
+    fib::trace::dump(out);
+    return out.str();
+  }
+
+  bool starts_with(const std::string & s, const std::string & prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+  }
+
+  bool contains(const std::string & s, const std::string & part) {
+    return s.find(part) != std::string::npos;
+  }
+
+#ifdef FIB_TRACE
+  std::vector<std::string> lines(const std::string & s) {
+    std::vector<std::string> result;
+    std::istringstream in(s);
+    for (std::string line; std::getline(in, line);) result.push_back(line);
+    return result;
+  }
+
+  /// the tid of the thread named @p name, as a string
+  std::string tid_of(const std::vector<std::string> & ls, const std::string & name) {
+    for (const std::string & l : ls) {
+      if (!contains(l, "\"thread_name\"") || !contains(l, "\"name\":\"" + name + "\"")) continue;
+      std::size_t at = l.find("\"tid\":") + 6;
+      return l.substr(at, l.find(',', at) - at);
+    }
+    return std::string();
+  }
+#endif
+}
+
+int main() {
+  std::string empty = dump();
+  FIB_CHECK(starts_with(empty, "{\"traceEvents\":["));
+  FIB_CHECK(contains(empty, "\"displayTimeUnit\":\"ns\"}"));
+
+  // a file, or not
+  FIB_CHECK(!fib::trace::dump(std::string("/nonexistent/directory/trace.json")));
+  FIB_CHECK(fib::trace::dump(std::string("test_trace.json")));
+  std::remove("test_trace.json");
+
+#ifdef FIB_TRACE
+  // a ring that has wrapped around keeps its newest events, less the slot the writer may be reusing
+  {
+    const long n = 2 * FIB_TRACE_CAPACITY + 3;
+    std::thread writer([&] {
+      fib::trace::name_thread("writer");
+      for (long i = 0; i < n; ++i) fib::trace::instant(fib::trace::what::deal, std::int32_t(i));
+    });
+    writer.join();
+    std::vector<std::string> ls = lines(dump());
+    std::string tid = tid_of(ls, "writer");
+    FIB_CHECK(!tid.empty());
+    long kept = 0, first = -1, last = -1;
+    for (const std::string & l : ls) {
+      if (!contains(l, "\"tid\":" + tid + ",") || !contains(l, "\"ph\":\"i\"")) continue;
+      FIB_CHECK(contains(l, "\"name\":\"deal\""));
+      long arg = std::stol(l.substr(l.find("\"arg\":") + 6));
+      if (first < 0) first = arg;
+      else FIB_CHECK(arg == last + 1);
+      last = arg;
+      ++kept;
+    }
+    FIB_CHECK(kept == FIB_TRACE_CAPACITY - 1);
+    FIB_CHECK(last == n - 1);
+    FIB_CHECK(first == n - FIB_TRACE_CAPACITY + 1);
+  }
+
+  // nested slices, and a pool's own activity
+  {
+    fib::trace::name_thread("main");
+    {
+      fib::trace::span outer(fib::trace::what::enumerator, 7);
+      fib::trace::instant(fib::trace::what::resume);
+    }
+    std::mt19937 rng(1);
+    {
+      fib::pool p(2, rng);
+      fib::latch joined(10);
+      for (int i = 0; i < 10; ++i) p.submit([&](fib::worker &) { joined.count_down(); });
+      joined.wait();
+    }
+    std::string out = dump();
+    std::vector<std::string> ls = lines(out);
+    std::string tid = tid_of(ls, "main");
+    FIB_CHECK(!tid.empty());
+    std::vector<std::string> mine;
+    for (const std::string & l : ls) if (contains(l, "\"tid\":" + tid + ",") && !contains(l, "thread_name")) mine.push_back(l);
+    FIB_CHECK(mine.size() == 3);
+    FIB_CHECK(contains(mine[0], "\"name\":\"enumerator\",\"ph\":\"B\"") && contains(mine[0], "\"arg\":7"));
+    FIB_CHECK(contains(mine[1], "\"name\":\"resume\",\"ph\":\"i\""));
+    FIB_CHECK(contains(mine[2], "\"name\":\"enumerator\",\"ph\":\"E\""));
+    FIB_CHECK(contains(out, "\"name\":\"task\",\"ph\":\"B\""));
+  }
+#else
+  FIB_CHECK(dump() == empty);
+#endif
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fib.h"
+#include "check.h"
+
+namespace {
+  std::vector<int> order;
+  std::atomic<long> leaves(0);
+  std::atomic<std::size_t> deepest(0);
+  std::atomic<bool> done(false);
+
+  void wait_done() {
+    while (!done.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    done.store(false);
+  }
+
+  // a binary tree of spawns, numbering its nodes in the order they run
+  void preorder(fib::worker & w, int depth, int & next) {
+    order.push_back(next++);
+    if (depth == 0) return;
+    w.spawn([depth, &next](fib::worker & v) { preorder(v, depth - 1, next); });
+    fib::worker::current()->spawn([depth, &next](fib::worker & v) { preorder(v, depth - 1, next); });
+  }
+
+  void tree(fib::worker & w, int depth, long target) {
+    std::size_t queued = w.q[int(fib::priority::normal)].size(), seen = deepest.load();
+    while (queued > seen && !deepest.compare_exchange_weak(seen, queued)) {}
+    if (depth == 0) {
+      if (leaves.fetch_add(1) + 1 == target) done.store(true);
+      return;
+    }
+    w.spawn([depth, target](fib::worker & v) { tree(v, depth - 1, target); });
+    fib::worker::current()->spawn([depth, target](fib::worker & v) { tree(v, depth - 1, target); });
+  }
+
+  // fork-join fibonacci, joining on a latch
+  long pfib(int n) {
+    if (n < 12) {
+      long a = 0, b = 1;
+      for (int i = 0; i < n; ++i) {
+        long t = a + b;
+        a = b;
+        b = t;
+      }
+      return a;
+    }
+    long x = 0;
+    fib::latch joined(1);
+    fib::worker::current()->spawn([&](fib::worker &) {
+      x = pfib(n - 1);
+      joined.count_down();
+    });
+    long y = pfib(n - 2);
+    joined.wait();
+    return x + y;
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+
+  // on a lone worker, the child runs before the rest of its parent, so the tree runs in serial order
+  for (fib::spawn_policy how : { fib::spawn_policy::help_first, fib::spawn_policy::work_first }) {
+    order.clear();
+    fib::pool p(1, rng);
+    p.spawning.store(how);
+    p.submit([](fib::worker & w) {
+      w.spawn([](fib::worker &) { order.push_back(-1); });
+      order.push_back(-2);
+      int next = 0;
+      preorder(*fib::worker::current(), 3, next);
+      fib::worker::current()->spawn(fib::spawn_policy::help_first, [](fib::worker &) { done.store(true); });
+    });
+    wait_done();
+    if (how == fib::spawn_policy::work_first) {
+      FIB_CHECK(order.size() == 2 + 15);
+      FIB_CHECK(order[0] == -1 && order[1] == -2);
+      for (int i = 0; i < 15; ++i) FIB_CHECK(order[std::size_t(i) + 2] == i);
+    } else {
+      FIB_CHECK(order[0] == -2);
+    }
+  }
+
+  // queues stay as shallow as the recursion
+  {
+    const int depth = 16;
+    fib::pool p(1, rng);
+    p.spawning.store(fib::spawn_policy::work_first);
+    deepest.store(0);
+    leaves.store(0);
+    p.submit([](fib::worker & w) { tree(w, depth, 1L << depth); });
+    wait_done();
+    FIB_CHECK(leaves.load() == 1L << depth);
+    FIB_CHECK(deepest.load() <= std::size_t(depth) + 1);
+  }
+
+  // and parents resumed elsewhere still join correctly
+  {
+    fib::pool p(4, rng);
+    p.spawning.store(fib::spawn_policy::work_first);
+    FIB_CHECK(fib::async(p, [](fib::worker &) { return pfib(24); }).get() == 46368);
+  }
+}